@@ -6,6 +6,14 @@
 #include <linux/kdev_t.h>
 #include <linux/version.h>
 #include <linux/err.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/kref.h>
+#include <linux/uio.h> //for iov_iter (read_iter/write_iter)
+#include <linux/overflow.h>
+
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
 
 //*************************Pre-processor macros*****************************//
 #define MEM_SIZE_MAX_PCDEV1 1024
@@ -27,27 +35,23 @@
 //************************* FUNCTION DECLARATIONS *****************************//
 
 loff_t pcd_lseek(struct file *filep, loff_t offset, int whence);
-ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_pos);
-ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos);
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from);
 int pcd_open(struct inode *inode, struct file *filep);
 int pcd_release(struct inode *inode, struct file *filep);
+int pcd_mmap(struct file *filep, struct vm_area_struct *vma);
 int check_permission(int dev_perm, int access_mode);
 
 //************************* GLOBALS *****************************//
-/* Pseudo device' memory buffers */
-char device_buffer_pcdev1[MEM_SIZE_MAX_PCDEV1];
-char device_buffer_pcdev2[MEM_SIZE_MAX_PCDEV2];
-char device_buffer_pcdev3[MEM_SIZE_MAX_PCDEV3];
-char device_buffer_pcdev4[MEM_SIZE_MAX_PCDEV4];
-
 /* Device private data struct */
 struct pcdev_private_data
 {
-    char *buffer;
+    char *buffer; //vmalloc'ed in init (page backed for mmap)
     unsigned size;
     const char *serial_number;
     int perm; //permission. can use u8,u16 etc
     struct cdev cdev;
+    struct kref ref; //init and every vma. Last put frees the buffer
 };
 
 /* Driver private data struct */
@@ -67,25 +71,21 @@ struct pcdrv_private_data pcdrv_data =
     .total_devices = NO_OF_DEVICES,
     .pcdev_data = {
         [0] = {
-            .buffer = device_buffer_pcdev1,
             .size = MEM_SIZE_MAX_PCDEV1,
             .serial_number = "PCDEV1XYZ123",
             .perm = DEV_DRV_PERM_RDONLY, /*RD only*/
         },
         [1] = {
-            .buffer = device_buffer_pcdev2,
             .size = MEM_SIZE_MAX_PCDEV2,
             .serial_number = "PCDEV2XYZ123",
             .perm = DEV_DRV_PERM_WRONLY, /*WR only*/
         },
         [2] = {
-            .buffer = device_buffer_pcdev3,
             .size = MEM_SIZE_MAX_PCDEV3,
             .serial_number = "PCDEV3XYZ123",
             .perm = DEV_DRV_PERM_RDWR, /*RDWR*/
         },
         [3] = {
-            .buffer = device_buffer_pcdev4,
             .size = MEM_SIZE_MAX_PCDEV4,
             .serial_number = "PCDEV4XYZ123",
             .perm = DEV_DRV_PERM_RDWR, /*RDWR*/
@@ -98,121 +98,219 @@ struct file_operations pcd_fops =
 {
     .llseek = pcd_lseek,
     .open = pcd_open,
-    .read = pcd_read,
-    .write = pcd_write,
+    .read_iter = pcd_read_iter,
+    .write_iter = pcd_write_iter,
+    .mmap = pcd_mmap,
     .release = pcd_release,
     .owner = THIS_MODULE
 };
 
 //************************* FUNCTIONS *****************************//
 
+/* vm_flags is read only for drivers from 6.3 onwards. Hack to support newer kernel versions (host linux is newer currently) */
+static inline void pcd_vm_flags_mod(struct vm_area_struct *vma, vm_flags_t set, vm_flags_t clear)
+{
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 3, 0 ) )
+    vm_flags_mod(vma,set,clear);
+    #else
+    vma->vm_flags = (vma->vm_flags | set) & ~clear;
+    #endif
+}
+
 loff_t pcd_lseek(struct file *filep, loff_t offset, int whence)
 {   
     struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->size;  
+    loff_t max_size = pcdev_data->size; //loff_t: no truncation past 2 GiB
     loff_t temp=0;
-    pr_info("lseek requested\n");
-    pr_info("Current file position: %lld\n",filep->f_pos);
+    loff_t ret;
     switch(whence)
     {
         case SEEK_SET:
             if((offset>max_size) || (offset<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = offset;
             break;
         case SEEK_CUR:
-            temp = filep->f_pos + offset;
-            if ((temp>max_size) || (temp<0))
+            if (check_add_overflow(filep->f_pos,offset,&temp) || (temp>max_size) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = temp;
             break;
         case SEEK_END:
-            temp = max_size + offset;
-            if ((temp>max_size) || (temp<0))
+            if (check_add_overflow(max_size,offset,&temp) || (temp>max_size) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = temp;
             break;
         default:
-            return -EINVAL; //invalid arg received for whence
+            ret = -EINVAL; //invalid arg received for whence
+            goto out;
     }
 
-    pr_info("Updated file position: %lld\n",filep->f_pos);
-
     /* return update file position */
-    return filep->f_pos;
+    ret = filep->f_pos;
+out:
+    trace_pcd_lseek(iminor(file_inode(filep)),offset,whence,ret);
+    return ret;
 }
 
-ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_pos)
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->size;
-    pr_info("read requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
-
-    /*Adjust the count*/
-    if ((*f_pos+count) > max_size)
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    loff_t max_size = pcdev_data->size;
+    size_t count = iov_iter_count(to);
+    loff_t pos = iocb->ki_pos;
+    ssize_t ret;
+
+    /*Adjust the count. In loff_t: pread may start anywhere, past the end reads nothing*/
+    if (pos >= max_size)
+        count = 0;
+    else if (count > max_size - pos)
+        count = max_size - pos;
+
+    /*copy to user. All segments of a readv/preadv2 are served in this one pass*/
+    ret = copy_to_iter(pcdev_data->buffer+pos,count,to);
+    if (!ret && count)
     {
-        count = max_size - *f_pos;
-    }
-
-    /*copy to user*/
-    if (copy_to_user(buff,pcdev_data->buffer+(*f_pos),count))
-    {
-        return -EFAULT;
+        ret = -EFAULT;
+        goto out;
     }
 
     /*update current file position*/
-    *f_pos += count;
-    pr_info("Number of bytes successfully read: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
+    iocb->ki_pos += ret;
 
-    /* return number of bytes successfully read */
-    return count;
+    /* return number of bytes successfully read (short read on a partial fault) */
+out:
+    trace_pcd_read(iminor(file_inode(iocb->ki_filp)),pos,count,ret);
+    return ret;
 }
 
-ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos)
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->size;  
-    pr_info("write requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
-
-    /*Adjust the count*/
-    if ((*f_pos+count) > max_size)
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    loff_t max_size = pcdev_data->size;
+    size_t count = iov_iter_count(from);
+    loff_t pos = iocb->ki_pos;
+    ssize_t ret;
+
+    /*Adjust the count. In loff_t: pwrite may start anywhere, past the end there is no space*/
+    if (pos >= max_size)
     {
-        count = max_size - *f_pos;
+        ret = -ENOSPC;
+        goto out;
     }
+    if (count > max_size - pos)
+        count = max_size - pos;
 
     if (!count)
     {
-        pr_err("No space left on the device\n");
-        return -ENOMEM;
+        ret = 0; //zero length write
+        goto out;
     }
 
-    /*copy to user*/
-    if (copy_from_user(pcdev_data->buffer+(*f_pos),buff,count)) 
-    /*
-    * Found a bug above during development. 
-    * Used &pcdev_data->buffer instead of direct dereference for pointer. 
-    * This caused mem overwrite. Kernel memory is so insecure. This caused segmentation fault big crash (memory leak).
-    */
+    /*copy from user. All segments of a writev/pwritev2 are gathered in this one pass*/
+    ret = copy_from_iter(pcdev_data->buffer+pos,count,from);
+    if (!ret)
     {
-        return -EFAULT;
+        ret = -EFAULT;
+        goto out;
     }
 
     /*update current file position*/
-    *f_pos += count;
-    pr_info("Number of bytes successfully written: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
+    iocb->ki_pos += ret;
 
-    /* return number of bytes successfully written */
-    return count;
+    /* return number of bytes successfully written (short write on a partial fault) */
+out:
+    trace_pcd_write(iminor(file_inode(iocb->ki_filp)),pos,count,ret);
+    return ret;
+}
+
+/* kref release: module cleanup is done with the device and no mapping is left */
+static void pcd_buffer_release(struct kref *ref)
+{
+    struct pcdev_private_data *pcdev_data = container_of(ref,struct pcdev_private_data,ref);
+
+    vfree(pcdev_data->buffer);
+    pcdev_data->buffer = NULL;
+}
+
+static vm_fault_t pcd_vm_fault(struct vm_fault *vmf)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(vmf->vma->vm_private_data);
+    unsigned long offset = vmf->pgoff << PAGE_SHIFT;
+    struct page *page;
+
+    if (offset >= pcdev_data->size)
+        return VM_FAULT_SIGBUS;
+
+    /* buffer is vmalloc'ed, so every page of it is a real struct page we can hand out */
+    page = vmalloc_to_page(pcdev_data->buffer + offset);
+    if (!page)
+        return VM_FAULT_SIGBUS;
+    get_page(page);
+    vmf->page = page;
+    return 0;
+}
+
+/* every vma (fork and split copies included) holds the buffer until munmap */
+static void pcd_vm_open(struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(vma->vm_private_data);
+    kref_get(&pcdev_data->ref);
+}
+
+static void pcd_vm_close(struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(vma->vm_private_data);
+    kref_put(&pcdev_data->ref,pcd_buffer_release);
+}
+
+static const struct vm_operations_struct pcd_vm_ops =
+{
+    .open = pcd_vm_open,
+    .close = pcd_vm_close,
+    .fault = pcd_vm_fault,
+};
+
+int pcd_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    unsigned long map_size = PAGE_ALIGN(pcdev_data->size);
+    unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+    unsigned long len = vma->vm_end - vma->vm_start;
+    int perm = pcdev_data->perm;
+
+    /* mapping must stay inside the device buffer */
+    if ((offset >= map_size) || (len > map_size - offset))
+        return -EINVAL;
+
+    /* device permission decides which PROT flags a shared mapping may have (now and after mprotect) */
+    if (!(perm & DEV_DRV_PERM_RDONLY))
+    {
+        if (vma->vm_flags & (VM_READ|VM_EXEC))
+            return -EACCES;
+        pcd_vm_flags_mod(vma,0,VM_MAYREAD|VM_MAYEXEC);
+    }
+    if (!(perm & DEV_DRV_PERM_WRONLY) && (vma->vm_flags & VM_SHARED))
+    {
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+        pcd_vm_flags_mod(vma,0,VM_MAYWRITE);
+    }
+
+    /* buffer can't grow under a mapping, no point in dumping it either */
+    pcd_vm_flags_mod(vma,VM_DONTEXPAND|VM_DONTDUMP,0);
+    vma->vm_ops = &pcd_vm_ops;
+    vma->vm_private_data = pcdev_data;
+    kref_get(&pcdev_data->ref); //->open is not called for the first vma, ->close is
+    return 0;
 }
 
 int check_permission(int dev_perm, int access_mode)
@@ -225,8 +323,8 @@ int check_permission(int dev_perm, int access_mode)
     /*Ensure Write only access*/
     if ((DEV_DRV_PERM_WRONLY==dev_perm)&&(!(access_mode&FMODE_READ) && (access_mode&FMODE_WRITE)))
         return PCD_DRV_SUCCESS;
-    pr_info("FAILED. DEBUG msg: access_mode: 0x%x, fmode_values: FMODE_READ: 0x%x and FMODE_WRITE: 0x%x\n",access_mode,FMODE_READ,FMODE_WRITE);
-    pr_info("FAILED. DEBUG msg: local dev perm: 0x%x\n",dev_perm);
+    pr_debug("FAILED. DEBUG msg: access_mode: 0x%x, fmode_values: FMODE_READ: 0x%x and FMODE_WRITE: 0x%x\n",access_mode,FMODE_READ,FMODE_WRITE);
+    pr_debug("FAILED. DEBUG msg: local dev perm: 0x%x\n",dev_perm);
     return -EPERM;
 }
 
@@ -236,7 +334,6 @@ int pcd_open(struct inode *inode, struct file *filep)
     struct pcdev_private_data *pcdev_data;
     /* find out on which device file open was attempted by userspace */
     int minor_n=MINOR(inode->i_rdev);
-    pr_info("minor access: %d\n",minor_n);
 
     /* Get device private data struct */
     pcdev_data = container_of(inode->i_cdev,struct pcdev_private_data,cdev);
@@ -246,15 +343,19 @@ int pcd_open(struct inode *inode, struct file *filep)
     That's why you can store in filep and reuse. */
     filep->private_data = (void*)pcdev_data;
 
+    /* read_iter/write_iter take no lock and allocate nothing, so RWF_NOWAIT/IOCB_NOWAIT can be honoured.
+    Only a fault on the user buffer during the copy can sleep, as for any file */
+    filep->f_mode |= FMODE_NOWAIT;
+
     /* check permission */
     ret = check_permission(pcdev_data->perm,filep->f_mode);
-    (!ret)?pr_info("open is successful\n"):pr_info("open is unsuccessful\n");
+    trace_pcd_open(minor_n,filep->f_mode,ret);
     return ret;
 }
 
 int pcd_release(struct inode *inode, struct file *filep)
 {
-    pr_info("release is successful\n");
+    trace_pcd_release(MINOR(inode->i_rdev));
     return 0;
 }
 
@@ -285,6 +386,16 @@ static int __init pcd_driver_init(void)
     {
         pr_info("Device number <major>:<minor> = %d:%d\n",MAJOR(pcdrv_data.device_number+i),MINOR(pcdrv_data.device_number+i));
 
+        /* Pseudo device' memory buffer. Page backed so it can be mmapped */
+        pcdrv_data.pcdev_data[i].buffer = vzalloc(pcdrv_data.pcdev_data[i].size);
+        if (!pcdrv_data.pcdev_data[i].buffer)
+        {
+            pr_err("buffer allocation failed\n");
+            ret = -ENOMEM;
+            goto unwind;
+        }
+        kref_init(&pcdrv_data.pcdev_data[i].ref);
+
         /* 2. Initialize cdev struct with fops */
         cdev_init(&pcdrv_data.pcdev_data[i].cdev,&pcd_fops);
 
@@ -294,7 +405,7 @@ static int __init pcd_driver_init(void)
         if (ret<0)
         {
             pr_err("cdev add failed\n");
-            goto cdev_del;
+            goto buffer_put;
         }
 
 
@@ -304,7 +415,7 @@ static int __init pcd_driver_init(void)
         {
             pr_err("device creation failed\n");
             ret = PTR_ERR(pcdrv_data.device_pcd);
-            goto class_del;
+            goto cdev_del;
         }
     }
 
@@ -313,11 +424,15 @@ static int __init pcd_driver_init(void)
     return 0;
 
 cdev_del:
-class_del:
-    for(;i>=0;i--) //reverse loop from current i
+    cdev_del(&pcdrv_data.pcdev_data[i].cdev);
+buffer_put:
+    kref_put(&pcdrv_data.pcdev_data[i].ref,pcd_buffer_release);
+unwind:
+    for(i--;i>=0;i--) //reverse loop over the fully set up devices before current i
     {
-        device_destroy(pcdrv_data.class_pcd,pcdrv_data.device_number+i); // can be called for invalid case also. it is safe
+        device_destroy(pcdrv_data.class_pcd,pcdrv_data.device_number+i);
         cdev_del(&pcdrv_data.pcdev_data[i].cdev);
+        kref_put(&pcdrv_data.pcdev_data[i].ref,pcd_buffer_release);
     }
     class_destroy(pcdrv_data.class_pcd);
 ureg_char_dev:
@@ -334,6 +449,7 @@ static void __exit pcd_driver_cleanup(void)
     {
         device_destroy(pcdrv_data.class_pcd,pcdrv_data.device_number+i);
         cdev_del(&pcdrv_data.pcdev_data[i].cdev);
+        kref_put(&pcdrv_data.pcdev_data[i].ref,pcd_buffer_release); //or on the last munmap
     }
     class_destroy(pcdrv_data.class_pcd);
     unregister_chrdev_region(pcdrv_data.device_number,NO_OF_DEVICES);
@@ -1,19 +1,27 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/numa.h>
 
 #include "platform.h"
 
+//*************************Pre-processor macros*****************************//
+#define PCD_BULK_SERIAL_LEN 16 //"PCDEVBLK" + up to 7 digits
+
 //************************* Function prototypes *****************************//
 void pcdev_release(struct device *dev);
 
 //************************* GLOBALS *****************************//
 
-/* 1. Create two platform data*/
+/* 1. Create two platform data. Fields left out are 0: array mode, sparse backing, no prefault, no replicas */
 struct pcdev_platform_data pcdev_data[] = {
-    [0] = {.size = 512,.perm = DEV_DRV_PERM_RDWR,.serial_number = "PCDEVABC111"},
-    [1] = {.size = 1024,.perm = DEV_DRV_PERM_RDWR,.serial_number = "PCDEVXYZ222"},
-    [2] = {.size = 128,.perm = DEV_DRV_PERM_RDONLY,.serial_number = "PCDEVDEF333"},
-    [3] = {.size = 32,.perm = DEV_DRV_PERM_WRONLY,.serial_number = "PCDEVIJK444"}
+    [0] = {.size = 512,.perm = DEV_DRV_PERM_RDWR,.serial_number = "PCDEVABC111",.numa_node = NUMA_NO_NODE},
+    [1] = {.size = 1024,.perm = DEV_DRV_PERM_RDWR,.serial_number = "PCDEVXYZ222",.numa_node = NUMA_NO_NODE},
+    [2] = {.size = 128,.perm = DEV_DRV_PERM_RDONLY,.serial_number = "PCDEVDEF333",.numa_node = NUMA_NO_NODE},
+    [3] = {.size = 32,.perm = DEV_DRV_PERM_WRONLY,.serial_number = "PCDEVIJK444",.numa_node = NUMA_NO_NODE}
 };
 
 /* 2. Create two platform devices */
@@ -61,6 +69,34 @@ struct platform_device *platform_devices[]=
     &platform_pcdev_4
 };
 
+/*
+ * Bulk devices for scale benchmarking, on top of the four above:
+ *   insmod pcd_device_setup.ko count=10000 size_min=512 size_max=65536 perm_mix=2:1:1
+ * Sizes are spread log-uniformly over [size_min,size_max] in powers of two, perms are dealt out
+ * round robin in the rw:ro:wo ratio of perm_mix, names cycle over the driver's id table.
+ * The driver needs minors for all of them (pcd_platform_driver.ko max_devices >= count + 4).
+ */
+static unsigned int count;
+module_param(count,uint,S_IRUGO);
+MODULE_PARM_DESC(count,"Number of extra platform devices to register (default 0)");
+
+static unsigned long size_min = 512;
+module_param(size_min,ulong,S_IRUGO);
+MODULE_PARM_DESC(size_min,"Smallest bulk device size in bytes (default 512)");
+
+static unsigned long size_max = 512;
+module_param(size_max,ulong,S_IRUGO);
+MODULE_PARM_DESC(size_max,"Largest bulk device size in bytes (default 512)");
+
+static char *perm_mix = "1:0:0";
+module_param(perm_mix,charp,S_IRUGO);
+MODULE_PARM_DESC(perm_mix,"rw:ro:wo ratio of bulk device permissions (default 1:0:0)");
+
+static const char * const pcdev_names[] = {"pcdev-A1x","pcdev-B1x","pcdev-C1x","pcdev-D1x"};
+
+static struct platform_device **bulk_pdevs; //count entries, NULL where registration failed
+static char (*bulk_serials)[PCD_BULK_SERIAL_LEN]; //platform data is copied but the serial number string is not
+
 //************************* FUNCTIONS *****************************//
 
 void pcdev_release(struct device *dev)
@@ -68,14 +104,137 @@ void pcdev_release(struct device *dev)
     pr_info("Device release\n");
 }
 
+/* Size of bulk device i: size_min, 2*size_min, 4*size_min ... up to size_max, then around again */
+static u64 bulk_size(unsigned int i)
+{
+    unsigned int steps = ilog2(size_max / size_min) + 1;
+    return min_t(u64,(u64)size_min << (i % steps),size_max);
+}
+
+/* Perm of bulk device i, dealt out in the rw:ro:wo ratio */
+static int bulk_perm(unsigned int i, const unsigned int mix[3])
+{
+    unsigned int slot = i % (mix[0] + mix[1] + mix[2]);
+
+    if(slot < mix[0])
+        return DEV_DRV_PERM_RDWR;
+    if(slot < mix[0] + mix[1])
+        return DEV_DRV_PERM_RDONLY;
+    return DEV_DRV_PERM_WRONLY;
+}
+
+static int pcdev_bulk_register(void)
+{
+    struct pcdev_platform_data pdata = {0};
+    struct platform_device_info info = {0};
+    unsigned int mix[3];
+    unsigned int i, registered = 0, bound = 0;
+    u64 t0, t_reg, t_probe, t_wait;
+
+    if(!count)
+        return 0;
+    if((size_min == 0) || (size_max < size_min) || (count > 9999999))
+        return -EINVAL;
+    if((sscanf(perm_mix,"%u:%u:%u",&mix[0],&mix[1],&mix[2]) != 3) || !(mix[0] + mix[1] + mix[2]))
+        return -EINVAL;
+
+    bulk_pdevs = kvcalloc(count,sizeof(*bulk_pdevs),GFP_KERNEL);
+    bulk_serials = kvcalloc(count,sizeof(*bulk_serials),GFP_KERNEL);
+    if(!bulk_pdevs || !bulk_serials)
+    {
+        kvfree(bulk_pdevs);
+        kvfree(bulk_serials);
+        bulk_pdevs = NULL;
+        bulk_serials = NULL;
+        return -ENOMEM;
+    }
+
+    pdata.numa_node = NUMA_NO_NODE;
+    info.data = &pdata; //copied by the platform core
+    info.size_data = sizeof(pdata);
+    t0 = ktime_get_ns();
+    for(i = 0; i < count; i++)
+    {
+        snprintf(bulk_serials[i],PCD_BULK_SERIAL_LEN,"PCDEVBLK%u",i);
+        pdata.size = bulk_size(i);
+        pdata.perm = bulk_perm(i,mix);
+        pdata.serial_number = bulk_serials[i];
+        info.name = pcdev_names[i % ARRAY_SIZE(pcdev_names)];
+        info.id = ARRAY_SIZE(platform_devices) + i; //the driver maps id to minor, keep clear of the four above
+        bulk_pdevs[i] = platform_device_register_full(&info);
+        if(IS_ERR(bulk_pdevs[i]))
+        {
+            pr_err("bulk device %u registration failed: %ld\n",i,PTR_ERR(bulk_pdevs[i]));
+            bulk_pdevs[i] = NULL;
+            continue;
+        }
+        registered++;
+        cond_resched();
+    }
+    t_reg = ktime_get_ns() - t0;
+
+    /* a synchronous driver probed inside register already, this waits for the async/deferred probes.
+       Probe time runs from the first register, async probes start before the loop is done */
+    wait_for_device_probe();
+    t_probe = ktime_get_ns() - t0;
+    t_wait = t_probe - t_reg;
+
+    for(i = 0; i < count; i++)
+    {
+        if(bulk_pdevs[i] && bulk_pdevs[i]->dev.driver)
+            bound++;
+    }
+    pr_info("bulk: %u/%u registered in %llu us (%llu ns/dev), %u bound in %llu us (probe wait %llu us)\n",
+            registered,count,t_reg / NSEC_PER_USEC,registered ? t_reg / registered : 0,
+            bound,t_probe / NSEC_PER_USEC,t_wait / NSEC_PER_USEC);
+    return 0;
+}
+
+static void pcdev_bulk_unregister(void)
+{
+    unsigned int i, unregistered = 0;
+    u64 t0;
+
+    if(!bulk_pdevs)
+        return;
+    t0 = ktime_get_ns();
+    for(i = count; i-- > 0;)
+    {
+        if(!bulk_pdevs[i])
+            continue;
+        platform_device_unregister(bulk_pdevs[i]);
+        unregistered++;
+        cond_resched();
+    }
+    t0 = ktime_get_ns() - t0;
+    pr_info("bulk: %u unregistered in %llu us (%llu ns/dev)\n",
+            unregistered,t0 / NSEC_PER_USEC,unregistered ? t0 / unregistered : 0);
+    kvfree(bulk_pdevs);
+    kvfree(bulk_serials); //after unregister, removal may still print the serial number
+    bulk_pdevs = NULL;
+    bulk_serials = NULL;
+}
+
 static int __init pcdev_platform_init(void) //init is int type.
 {
+    int ret;
+
     /*Register platform device*/
     //platform_device_register(&platform_pcdev_1); //Adding individually. Optimized way used below
     //platform_device_register(&platform_pcdev_2);
     //platform_device_register(&platform_pcdev_3);
     //platform_device_register(&platform_pcdev_4);
     platform_add_devices(platform_devices,ARRAY_SIZE(platform_devices)); //check how ARRAY_SIZE works and remember!
+    ret = pcdev_bulk_register();
+    if(ret)
+    {
+        pr_err("bulk device setup failed: %d\n",ret);
+        platform_device_unregister(&platform_pcdev_1);
+        platform_device_unregister(&platform_pcdev_2);
+        platform_device_unregister(&platform_pcdev_3);
+        platform_device_unregister(&platform_pcdev_4);
+        return ret;
+    }
     pr_info("Device setup module loaded \n");
     return 0;
 }
@@ -83,6 +242,7 @@ static int __init pcdev_platform_init(void) //init is int type.
 static void __exit pcdev_platform_exit(void) //exit is void type.
 {
     /*Unregister platform device*/
+    pcdev_bulk_unregister();
     platform_device_unregister(&platform_pcdev_1);
     platform_device_unregister(&platform_pcdev_2);
     platform_device_unregister(&platform_pcdev_3);
@@ -19,7 +19,7 @@
 #define MEM_SIZE_MAX_PCDEV4 512
 
 #define NO_OF_DEVICES 4 //UNUSED
-#define MAX_DEVICES 10
+#define MAX_DEVICES 10 //default of the max_devices module param
 
 /* LOCAL ERROR/STATUS DEFINES */
 #define PCD_DRV_SUCCESS 0
@@ -104,6 +104,11 @@ struct pcdrv_private_data
 
 struct pcdrv_private_data pcdrv_data;
 
+/* size of the chrdev region, platform device ids 0..max_devices-1 get a device file */
+static unsigned int max_devices = MAX_DEVICES;
+module_param(max_devices,uint,S_IRUGO);
+MODULE_PARM_DESC(max_devices,"Number of minors reserved for pcdevs (default 10)");
+
 
 /* File Ops of driver */
 struct file_operations pcd_fops = 
@@ -276,7 +281,7 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     struct pcdev_platform_data *pdata;
     int ret=0;
 
-    pr_info("A device is detected\n");
+    pr_debug("A device is detected\n");
 
     /* 1. Get the platform data */
     //pdata = pdev->dev.platform_data;
@@ -302,12 +307,12 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     dev_data->pdata.serial_number=pdata->serial_number;
     dev_data->pdata.size=pdata->size;
     dev_data->pdata.perm=pdata->perm;
-    pr_info("Device serial number: %s\n",dev_data->pdata.serial_number);
-    pr_info("Device size: %d bytes\n",dev_data->pdata.size);
-    pr_info("Device permission: 0x%x\n",dev_data->pdata.perm);
+    pr_debug("Device serial number: %s\n",dev_data->pdata.serial_number);
+    pr_debug("Device size: %llu bytes\n",dev_data->pdata.size);
+    pr_debug("Device permission: 0x%x\n",dev_data->pdata.perm);
 
-    pr_info("Config Item 1: %d",pcdev_cfg[pdev->id_entry->driver_data].config_item1);
-    pr_info("Config Item 2: %d",pcdev_cfg[pdev->id_entry->driver_data].config_item2);
+    pr_debug("Config Item 1: %d",pcdev_cfg[pdev->id_entry->driver_data].config_item1);
+    pr_debug("Config Item 2: %d",pcdev_cfg[pdev->id_entry->driver_data].config_item2);
 
     /* 3. Dynamically allocate memory for device buffer using size information from the platform data */
     //dev_data->buffer = kzalloc(dev_data->pdata.size,GFP_KERNEL);
@@ -320,6 +325,12 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     }
 
     /* 4. Get the device number */
+    if((pdev->id < 0) || (pdev->id >= max_devices))
+    {
+        pr_err("device id %d out of range, max_devices is %u\n",pdev->id,max_devices);
+        ret = -ENOSPC;
+        goto buffer_free;
+    }
     dev_data->dev_num=pcdrv_data.device_num_base + pdev->id;
 
     /* 5. Do cdev init and cdev add */
@@ -343,7 +354,7 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 
     pcdrv_data.total_devices++;
 
-    pr_info("The probe was successful\n");
+    pr_debug("The probe was successful\n");
     return 0;
 
     /* 7. Error handling */
@@ -371,16 +382,21 @@ int pcd_platform_driver_remove(struct platform_device *pdev)
     //kfree(dev_data->buffer); //N/R because devm function used in probe function
     //kfree(dev_data); //N/R because devm function used in probe function
     pcdrv_data.total_devices--;
-    pr_info("A device is removed\n");
+    pr_debug("A device is removed\n");
     return 0;
 }
 
 static int __init pcd_platform_driver_init(void)
 {   
     int ret=0;
+    if((max_devices == 0) || (max_devices > MINORMASK + 1))
+    {
+        pr_err("max_devices %u out of range\n",max_devices);
+        return -EINVAL;
+    }
     pcdrv_data.total_devices=0;//Initializing devices count. Increment/Decrement will happen when new device detected/removed in probe/remove functions respectively.
-    /* 1. Dynamically allocate device number for MAX_DEVICES */
-    ret=alloc_chrdev_region(&pcdrv_data.device_num_base,0,MAX_DEVICES,"pcd_devices"); //it can fail. Handle error
+    /* 1. Dynamically allocate device number for max_devices */
+    ret=alloc_chrdev_region(&pcdrv_data.device_num_base,0,max_devices,"pcd_devices"); //it can fail. Handle error
     if (ret<0)
     {
         pr_err("alloc char dev failed\n");
@@ -397,7 +413,7 @@ static int __init pcd_platform_driver_init(void)
     {
         pr_err("class creation failed\n");
         ret = PTR_ERR(pcdrv_data.class_pcd);
-        unregister_chrdev_region(pcdrv_data.device_num_base,MAX_DEVICES);
+        unregister_chrdev_region(pcdrv_data.device_num_base,max_devices);
         return ret;
     }
 
@@ -416,8 +432,8 @@ static void __exit pcd_platform_driver_cleanup(void)
     /* 2. Class destroy */
     class_destroy(pcdrv_data.class_pcd);
 
-    /* 3. Unregister char dev region (all device numbers for MAX_DEVICES) */
-    unregister_chrdev_region(pcdrv_data.device_num_base,MAX_DEVICES);
+    /* 3. Unregister char dev region (all device numbers for max_devices) */
+    unregister_chrdev_region(pcdrv_data.device_num_base,max_devices);
 
     pr_info("PCD-Platform driver Module unloaded\n");
 }
@@ -5,12 +5,31 @@
 #define DEV_DRV_PERM_WRONLY 0x10
 #define DEV_DRV_PERM_RDWR   0x11
 
+/* Device access mode macros */
+#define PCD_MODE_ARRAY 0 //fixed size seekable array (default)
+#define PCD_MODE_FIFO  1 //pipe like ring buffer with blocking read/write
+#define PCD_MODE_MSG   2 //queue of records: a write enqueues one, a read dequeues one
+#define PCD_MODE_LOG   3 //broadcast log of records: a write appends one, every open file reads all of them
+
+/* Device backing macros */
+#define PCD_BACKING_SPARSE 0 //pages allocated on first write (default)
+#define PCD_BACKING_PAGES  1 //every page allocated at probe
+#define PCD_BACKING_CONTIG 2 //every page allocated at probe, in physically contiguous runs
+#define PCD_BACKING_SHMEM  3 //swappable, pages live in an internal tmpfs file
+#define PCD_BACKING_HUGE   4 //every page allocated at probe, in PMD sized folios mapped with huge PMDs
+
 #define pr_fmt(fmt) "%s : "fmt,__func__ //WARNING EXPECTED. redefined pr_fmt. and it works because kernel builds these cases for pr_* cases
 
 //*************************Struct declarations*****************************//
+/* keep in sync with ../pcd_sysfs/platform.h, pcd_device_setup registers devices both drivers probe */
 struct pcdev_platform_data
 {
-    int size;
+    u64 size; //bytes, 64 bit for multi GB devices
     int perm;
     const char *serial_number;
+    int mode; //PCD_MODE_*
+    int backing; //PCD_BACKING_*
+    int numa_node; //node the pages come from, NUMA_NO_NODE for no preference
+    bool prefault; //allocate every page at probe, not on first access
+    bool replicas; //a copy per NUMA node, reads served from the local one
 };
\ No newline at end of file
@@ -8,12 +8,20 @@
 #include <linux/err.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
+#include <linux/kref.h>
 #include <linux/mod_devicetable.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h> //for iov_iter (read_iter/write_iter)
+#include <linux/overflow.h>
 
 #include "platform.h"
 
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
+
 //*************************Pre-processor macros*****************************//
 #define MEM_SIZE_MAX_PCDEV1 1024
 #define MEM_SIZE_MAX_PCDEV2 512
@@ -30,10 +38,11 @@
 //************************* FUNCTION DECLARATIONS *****************************//
 
 loff_t pcd_lseek(struct file *filep, loff_t offset, int whence);
-ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_pos);
-ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos);
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from);
 int pcd_open(struct inode *inode, struct file *filep);
 int pcd_release(struct inode *inode, struct file *filep);
+int pcd_mmap(struct file *filep, struct vm_area_struct *vma);
 int check_permission(int dev_perm, int access_mode);
 
 /* Probe / Remove functions */
@@ -102,6 +111,7 @@ struct pcdev_private_data
     char *buffer;
     dev_t dev_num;
     struct cdev cdev;
+    struct kref ref; //probe, every open file and every vma. Last put frees the buffer
 };
 
 /* Driver private data struct */
@@ -123,121 +133,219 @@ struct file_operations pcd_fops =
 {
     .llseek = pcd_lseek,
     .open = pcd_open,
-    .read = pcd_read,
-    .write = pcd_write,
+    .read_iter = pcd_read_iter,
+    .write_iter = pcd_write_iter,
+    .mmap = pcd_mmap,
     .release = pcd_release,
     .owner = THIS_MODULE
 };
 
 //************************* FUNCTIONS *****************************//
 
+/* vm_flags is read only for drivers from 6.3 onwards. Hack to support newer kernel versions (host linux is newer currently) */
+static inline void pcd_vm_flags_mod(struct vm_area_struct *vma, vm_flags_t set, vm_flags_t clear)
+{
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 3, 0 ) )
+    vm_flags_mod(vma,set,clear);
+    #else
+    vma->vm_flags = (vma->vm_flags | set) & ~clear;
+    #endif
+}
+
 loff_t pcd_lseek(struct file *filep, loff_t offset, int whence)
 {   
     struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->pdata.size;  
+    loff_t max_size = pcdev_data->pdata.size; //loff_t: no truncation past 2 GiB
     loff_t temp=0;
-    pr_info("lseek requested\n");
-    pr_info("Current file position: %lld\n",filep->f_pos);
+    loff_t ret;
     switch(whence)
     {
         case SEEK_SET:
             if((offset>max_size) || (offset<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = offset;
             break;
         case SEEK_CUR:
-            temp = filep->f_pos + offset;
-            if ((temp>max_size) || (temp<0))
+            if (check_add_overflow(filep->f_pos,offset,&temp) || (temp>max_size) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = temp;
             break;
         case SEEK_END:
-            temp = max_size + offset;
-            if ((temp>max_size) || (temp<0))
+            if (check_add_overflow(max_size,offset,&temp) || (temp>max_size) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = temp;
             break;
         default:
-            return -EINVAL; //invalid arg received for whence
+            ret = -EINVAL; //invalid arg received for whence
+            goto out;
     }
 
-    pr_info("Updated file position: %lld\n",filep->f_pos);
-
     /* return update file position */
-    return filep->f_pos;
+    ret = filep->f_pos;
+out:
+    trace_pcd_lseek(MINOR(pcdev_data->dev_num),offset,whence,ret);
+    return ret;
 }
 
-ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_pos)
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->pdata.size;
-    pr_info("read requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
-
-    /*Adjust the count*/
-    if ((*f_pos+count) > max_size)
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    loff_t max_size = pcdev_data->pdata.size;
+    size_t count = iov_iter_count(to);
+    loff_t pos = iocb->ki_pos;
+    ssize_t ret;
+
+    /*Adjust the count. In loff_t: pread may start anywhere, past the end reads nothing*/
+    if (pos >= max_size)
+        count = 0;
+    else if (count > max_size - pos)
+        count = max_size - pos;
+
+    /*copy to user. All segments of a readv/preadv2 are served in this one pass*/
+    ret = copy_to_iter(pcdev_data->buffer+pos,count,to);
+    if (!ret && count)
     {
-        count = max_size - *f_pos;
-    }
-
-    /*copy to user*/
-    if (copy_to_user(buff,pcdev_data->buffer+(*f_pos),count))
-    {
-        return -EFAULT;
+        ret = -EFAULT;
+        goto out;
     }
 
     /*update current file position*/
-    *f_pos += count;
-    pr_info("Number of bytes successfully read: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
+    iocb->ki_pos += ret;
 
-    /* return number of bytes successfully read */
-    return count;
+    /* return number of bytes successfully read (short read on a partial fault) */
+out:
+    trace_pcd_read(MINOR(pcdev_data->dev_num),pos,count,ret);
+    return ret;
 }
 
-ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos)
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->pdata.size;  
-    pr_info("write requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
-
-    /*Adjust the count*/
-    if ((*f_pos+count) > max_size)
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    loff_t max_size = pcdev_data->pdata.size;
+    size_t count = iov_iter_count(from);
+    loff_t pos = iocb->ki_pos;
+    ssize_t ret;
+
+    /*Adjust the count. In loff_t: pwrite may start anywhere, past the end there is no space*/
+    if (pos >= max_size)
     {
-        count = max_size - *f_pos;
+        ret = -ENOSPC;
+        goto out;
     }
+    if (count > max_size - pos)
+        count = max_size - pos;
 
     if (!count)
     {
-        pr_err("No space left on the device\n");
-        return -ENOMEM;
+        ret = 0; //zero length write
+        goto out;
     }
 
-    /*copy to user*/
-    if (copy_from_user(pcdev_data->buffer+(*f_pos),buff,count)) 
-    /*
-    * Found a bug above during development. 
-    * Used &pcdev_data->buffer instead of direct dereference for pointer. 
-    * This caused mem overwrite. Kernel memory is so insecure. This caused segmentation fault big crash (memory leak).
-    */
+    /*copy from user. All segments of a writev/pwritev2 are gathered in this one pass*/
+    ret = copy_from_iter(pcdev_data->buffer+pos,count,from);
+    if (!ret)
     {
-        return -EFAULT;
+        ret = -EFAULT;
+        goto out;
     }
 
     /*update current file position*/
-    *f_pos += count;
-    pr_info("Number of bytes successfully written: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
+    iocb->ki_pos += ret;
 
-    /* return number of bytes successfully written */
-    return count;
+    /* return number of bytes successfully written (short write on a partial fault) */
+out:
+    trace_pcd_write(MINOR(pcdev_data->dev_num),pos,count,ret);
+    return ret;
+}
+
+/* kref release: no open file or mapping is left, device is already removed */
+static void pcd_dev_release(struct kref *ref)
+{
+    struct pcdev_private_data *dev_data = container_of(ref,struct pcdev_private_data,ref);
+
+    vfree(dev_data->buffer);
+    kfree(dev_data);
+}
+
+static vm_fault_t pcd_vm_fault(struct vm_fault *vmf)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(vmf->vma->vm_private_data);
+    unsigned long offset = vmf->pgoff << PAGE_SHIFT;
+    struct page *page;
+
+    if (offset >= pcdev_data->pdata.size)
+        return VM_FAULT_SIGBUS;
+
+    /* buffer is vmalloc'ed, so every page of it is a real struct page we can hand out */
+    page = vmalloc_to_page(pcdev_data->buffer + offset);
+    if (!page)
+        return VM_FAULT_SIGBUS;
+    get_page(page);
+    vmf->page = page;
+    return 0;
+}
+
+/* every vma (fork and split copies included) holds the device, the buffer outlives remove until munmap */
+static void pcd_vm_open(struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(vma->vm_private_data);
+    kref_get(&pcdev_data->ref);
+}
+
+static void pcd_vm_close(struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(vma->vm_private_data);
+    kref_put(&pcdev_data->ref,pcd_dev_release);
+}
+
+static const struct vm_operations_struct pcd_vm_ops =
+{
+    .open = pcd_vm_open,
+    .close = pcd_vm_close,
+    .fault = pcd_vm_fault,
+};
+
+int pcd_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    unsigned long map_size = PAGE_ALIGN(pcdev_data->pdata.size);
+    unsigned long offset = vma->vm_pgoff << PAGE_SHIFT;
+    unsigned long len = vma->vm_end - vma->vm_start;
+    int perm = pcdev_data->pdata.perm;
+
+    /* mapping must stay inside the device buffer */
+    if ((offset >= map_size) || (len > map_size - offset))
+        return -EINVAL;
+
+    /* device permission decides which PROT flags a shared mapping may have (now and after mprotect) */
+    if (!(perm & DEV_DRV_PERM_RDONLY))
+    {
+        if (vma->vm_flags & (VM_READ|VM_EXEC))
+            return -EACCES;
+        pcd_vm_flags_mod(vma,0,VM_MAYREAD|VM_MAYEXEC);
+    }
+    if (!(perm & DEV_DRV_PERM_WRONLY) && (vma->vm_flags & VM_SHARED))
+    {
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+        pcd_vm_flags_mod(vma,0,VM_MAYWRITE);
+    }
+
+    /* buffer can't grow under a mapping, no point in dumping it either */
+    pcd_vm_flags_mod(vma,VM_DONTEXPAND|VM_DONTDUMP,0);
+    vma->vm_ops = &pcd_vm_ops;
+    vma->vm_private_data = pcdev_data;
+    kref_get(&pcdev_data->ref); //->open is not called for the first vma, ->close is
+    return 0;
 }
 
 int check_permission(int dev_perm, int access_mode)
@@ -250,8 +358,8 @@ int check_permission(int dev_perm, int access_mode)
     /*Ensure Write only access*/
     if ((DEV_DRV_PERM_WRONLY==dev_perm)&&(!(access_mode&FMODE_READ) && (access_mode&FMODE_WRITE)))
         return PCD_DRV_SUCCESS;
-    pr_info("FAILED. DEBUG msg: access_mode: 0x%x, fmode_values: FMODE_READ: 0x%x and FMODE_WRITE: 0x%x\n",access_mode,FMODE_READ,FMODE_WRITE);
-    pr_info("FAILED. DEBUG msg: local dev perm: 0x%x\n",dev_perm);
+    pr_debug("FAILED. DEBUG msg: access_mode: 0x%x, fmode_values: FMODE_READ: 0x%x and FMODE_WRITE: 0x%x\n",access_mode,FMODE_READ,FMODE_WRITE);
+    pr_debug("FAILED. DEBUG msg: local dev perm: 0x%x\n",dev_perm);
     return -EPERM;
 }
 
@@ -261,7 +369,6 @@ int pcd_open(struct inode *inode, struct file *filep)
     struct pcdev_private_data *pcdev_data;
     /* find out on which device file open was attempted by userspace */
     int minor_n=MINOR(inode->i_rdev);
-    pr_info("minor access: %d\n",minor_n);
 
     /* Get device private data struct */
     pcdev_data = container_of(inode->i_cdev,struct pcdev_private_data,cdev);
@@ -271,15 +378,24 @@ int pcd_open(struct inode *inode, struct file *filep)
     That's why you can store in filep and reuse. */
     filep->private_data = (void*)pcdev_data;
 
+    /* read_iter/write_iter take no lock and allocate nothing, so RWF_NOWAIT/IOCB_NOWAIT can be honoured.
+    Only a fault on the user buffer during the copy can sleep, as for any file */
+    filep->f_mode |= FMODE_NOWAIT;
+
     /* check permission */
     ret = check_permission(pcdev_data->pdata.perm,filep->f_mode);
-    (!ret)?pr_info("open is successful\n"):pr_info("open is unsuccessful\n");
+    if (!ret)
+        kref_get(&pcdev_data->ref); //open file keeps the device data after remove, dropped in release
+    trace_pcd_open(minor_n,filep->f_mode,ret);
     return ret;
 }
 
 int pcd_release(struct inode *inode, struct file *filep)
 {
-    pr_info("release is successful\n");
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+
+    trace_pcd_release(MINOR(inode->i_rdev));
+    kref_put(&pcdev_data->ref,pcd_dev_release);
     return 0;
 }
 
@@ -351,14 +467,15 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     }
 
     /* 2. Dynamically allocate memory for the device private data */
-    //dev_data = kzalloc(sizeof(*dev_data),GFP_KERNEL); //can use devm_kmalloc to avoid free. Refer: https://github.com/niekiran/linux-device-driver-1/blob/master/custom_drivers/004_pcd_platform_driver/pcd_platform_driver.c (line 302)
-    dev_data = devm_kzalloc(dev,sizeof(*dev_data),GFP_KERNEL); //devm usage
+    /* not devm: open files and mappings may hold it past remove, freed on the last kref put */
+    dev_data = kzalloc(sizeof(*dev_data),GFP_KERNEL);
     if(!dev_data)
     {
         dev_info(dev,"Cannot allocate memory\n");
         ret = -ENOMEM;
         goto out;
     }
+    kref_init(&dev_data->ref);
     dev_set_drvdata(&pdev->dev,dev_data);
     dev_data->pdata.serial_number=pdata->serial_number;
     dev_data->pdata.size=pdata->size;
@@ -372,12 +489,13 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
 
     /* 3. Dynamically allocate memory for device buffer using size information from the platform data */
     //dev_data->buffer = kzalloc(dev_data->pdata.size,GFP_KERNEL);
-    dev_data->buffer = devm_kzalloc(dev,dev_data->pdata.size,GFP_KERNEL); //devm usage
+    /* page backed (vmalloc) instead of devm_kzalloc so that the buffer can be mmapped page by page */
+    dev_data->buffer = vzalloc(dev_data->pdata.size);
     if(!dev_data->buffer)
     {
         dev_info(dev,"Cannot allocate memory\n");
         ret = -ENOMEM;
-        goto dev_data_free;
+        goto dev_data_put;
     }
 
     /* 4. Get the device number */
@@ -390,7 +508,7 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     if (ret<0)
     {
         dev_err(dev,"cdev add failed\n");
-        goto buffer_free;
+        goto dev_data_put;
     }
 
     /* 6. Create device file for the detected platform device */
@@ -410,12 +528,8 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     /* 7. Error handling */
 cdev_del:
     cdev_del(&dev_data->cdev);
-buffer_free:
-    //kfree(dev_data->buffer);
-    devm_kfree(&pdev->dev,dev_data->buffer); //devm function use. Actually it not required. if probe fails, dev resources will be cleared!
-dev_data_free:
-    //kfree(dev_data);
-    devm_kfree(&pdev->dev,dev_data); //devm function use. Actually it not required. if probe fails, dev resources will be cleared!
+dev_data_put:
+    kref_put(&dev_data->ref,pcd_dev_release); //frees the buffer too. An open that raced cdev_add keeps it until release
 out:
     dev_info(dev,"Device probe failed\n");
     return ret;
@@ -429,9 +543,8 @@ int pcd_platform_driver_remove(struct platform_device *pdev)
     device_destroy(pcdrv_data.class_pcd,dev_data->dev_num);
     /* 2. Remove a cdev entry from the system */
     cdev_del(&dev_data->cdev);
-    /* 3. Free the memory held by the device */
-    //kfree(dev_data->buffer); //N/R because devm function used in probe function
-    //kfree(dev_data); //N/R because devm function used in probe function
+    /* 3. Free the memory held by the device, or leave it to the last open file/mapping */
+    kref_put(&dev_data->ref,pcd_dev_release);
     pcdrv_data.total_devices--;
     dev_info(dev,"A device is removed\n");
     return 0;
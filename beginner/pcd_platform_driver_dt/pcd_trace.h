@@ -0,0 +1,97 @@
+/*
+ * Tracepoints for pcd file operations.
+ * Replaces the per call pr_info logging. Events are static keys, so they cost nothing until enabled:
+ *   echo 1 > /sys/kernel/tracing/events/pcd/enable
+ *   perf record -e 'pcd:*' ...
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pcd
+
+#if !defined(PCD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PCD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(pcd_open,
+    TP_PROTO(unsigned int minor, unsigned int f_mode, int ret),
+    TP_ARGS(minor, f_mode, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(unsigned int, f_mode)
+        __field(int, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->f_mode = f_mode;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u f_mode=0x%x ret=%d", __entry->minor, __entry->f_mode, __entry->ret)
+);
+
+TRACE_EVENT(pcd_release,
+    TP_PROTO(unsigned int minor),
+    TP_ARGS(minor),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+    ),
+    TP_printk("minor=%u", __entry->minor)
+);
+
+/* read and write carry the same fields. pos is the file position before the transfer */
+DECLARE_EVENT_CLASS(pcd_rw,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(minor, pos, count, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u pos=%lld count=%zu ret=%zd", __entry->minor, __entry->pos, __entry->count, __entry->ret)
+);
+
+DEFINE_EVENT(pcd_rw, pcd_read,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(minor, pos, count, ret)
+);
+
+DEFINE_EVENT(pcd_rw, pcd_write,
+    TP_PROTO(unsigned int minor, loff_t pos, size_t count, ssize_t ret),
+    TP_ARGS(minor, pos, count, ret)
+);
+
+TRACE_EVENT(pcd_lseek,
+    TP_PROTO(unsigned int minor, loff_t offset, int whence, loff_t ret),
+    TP_ARGS(minor, offset, whence, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, offset)
+        __field(int, whence)
+        __field(loff_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->offset = offset;
+        __entry->whence = whence;
+        __entry->ret = ret;
+    ),
+    TP_printk("minor=%u offset=%lld whence=%d ret=%lld", __entry->minor, __entry->offset, __entry->whence, __entry->ret)
+);
+
+#endif //PCD_TRACE_H
+
+/* Out of tree module: header is found through -I$(src) set in the Makefile */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pcd_trace
+#include <trace/define_trace.h>
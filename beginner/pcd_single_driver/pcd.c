@@ -7,6 +7,9 @@
 #include <linux/version.h>
 #include <linux/err.h>
 
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
+
 //*************************Pre-processor macros*****************************//
 #define DEV_MEM_SIZE 512
 #define MINOR_COUNT 1
@@ -50,14 +53,14 @@ struct device *device_pcd;
 loff_t pcd_lseek(struct file *filep, loff_t offset, int whence)
 {   
     loff_t temp=0;
-    pr_info("lseek requested\n");
-    pr_info("Current file position: %lld\n",filep->f_pos);
+    loff_t ret;
     switch(whence)
     {
         case SEEK_SET:
             if((offset>DEV_MEM_SIZE) || (offset<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = offset;
             break;
@@ -65,7 +68,8 @@ loff_t pcd_lseek(struct file *filep, loff_t offset, int whence)
             temp = filep->f_pos + offset;
             if ((temp>DEV_MEM_SIZE) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = temp;
             break;
@@ -73,24 +77,27 @@ loff_t pcd_lseek(struct file *filep, loff_t offset, int whence)
             temp = DEV_MEM_SIZE + offset;
             if ((temp>DEV_MEM_SIZE) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = temp;
             break;
         default:
-            return -EINVAL; //invalid arg received for whence
+            ret = -EINVAL; //invalid arg received for whence
+            goto out;
     }
 
-    pr_info("Updated file position: %lld\n",filep->f_pos);
-
     /* return update file position */
-    return filep->f_pos;
+    ret = filep->f_pos;
+out:
+    trace_pcd_lseek(iminor(file_inode(filep)),offset,whence,ret);
+    return ret;
 }
 
 ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_pos)
 {
-    pr_info("read requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
+    loff_t pos = *f_pos;
+    ssize_t ret;
 
     /*Adjust the count*/
     if ((*f_pos+count) > DEV_MEM_SIZE)
@@ -101,22 +108,24 @@ ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_
     /*copy to user*/
     if (copy_to_user(buff,&device_buffer[*f_pos],count))
     {
-        return -EFAULT;
+        ret = -EFAULT;
+        goto out;
     }
 
     /*update current file position*/
     *f_pos += count;
-    pr_info("Number of bytes successfully read: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
 
     /* return number of bytes successfully read */
-    return count;
+    ret = count;
+out:
+    trace_pcd_read(iminor(file_inode(filep)),pos,count,ret);
+    return ret;
 }
 
 ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos)
 {
-    pr_info("write requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
+    loff_t pos = *f_pos;
+    ssize_t ret;
 
     /*Adjust the count*/
     if ((*f_pos+count) > DEV_MEM_SIZE)
@@ -126,34 +135,37 @@ ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, lof
 
     if (!count)
     {
-        pr_err("No space left on the device\n");
-        return -ENOMEM;
+        /* No space left on the device */
+        ret = -ENOMEM;
+        goto out;
     }
 
     /*copy to user*/
     if (copy_from_user(&device_buffer[*f_pos],buff,count))
     {
-        return -EFAULT;
+        ret = -EFAULT;
+        goto out;
     }
 
     /*update current file position*/
     *f_pos += count;
-    pr_info("Number of bytes successfully written: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
 
     /* return number of bytes successfully written */
-    return count;
+    ret = count;
+out:
+    trace_pcd_write(iminor(file_inode(filep)),pos,count,ret);
+    return ret;
 }
 
 int pcd_open(struct inode *inode, struct file *filep)
 {
-    pr_info("open is successful\n");
+    trace_pcd_open(iminor(inode),filep->f_mode,0);
     return 0;
 }
 
 int pcd_release(struct inode *inode, struct file *filep)
 {
-    pr_info("release is successful\n");
+    trace_pcd_release(iminor(inode));
     return 0;
 }
 
@@ -0,0 +1,642 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*
+ * Backing store of a pcdev (org,backing).
+ * Sparse: an xarray of individually allocated pages indexed by page offset. A page is only allocated the
+ * first time it's written (or mmapped), never written ranges are holes that read as the zero page.
+ * Resident memory follows what was written, not what the DT declared.
+ * Pages/contiguous: the same xarray, fully allocated at probe (contiguous in the largest physically
+ * contiguous runs available). A hole punch zeroes instead of releasing, the layout stays as allocated.
+ * Huge: the same again with PMD sized folios, one xarray entry per subpage, so mmap faults can map a
+ * whole folio with one PMD. Single pages where no folio could be had (fragmentation) or doesn't fit (tail).
+ * Every entry holds a ref on its folio, the folio goes when the last of its entries (and mappings) did.
+ * Shmem: pages live in an internal tmpfs file instead, so they can be swapped out under memory pressure.
+ * Pages may be highmem, every access goes through the page (copy_page_*_iter, kmap).
+ * Copy on write: a device to device copy (pcd_backing_clone) can put the same page in two sparse backings,
+ * marked PCD_PAGE_SHARED in both. Whoever writes it first gets a private copy (pcd_backing_unshare), mmap
+ * faults only ever map private pages, so stores through a mapping never reach the other device.
+ *
+ * Locking: lookups are lockless (RCU + speculative page ref, like the page cache). Pages are only added
+ * by writers/faults and removed by a hole punch or a shrink, all of which hold the byte range lock over
+ * what they touch, so writers never see their page go away.
+ */
+
+//*************************Pre-processor macros*****************************//
+#define PCD_CONTIG_ORDER get_order(SZ_2M) //largest run the contiguous backing asks for
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define PCD_HUGE_ORDER HPAGE_PMD_ORDER
+#else
+#define PCD_HUGE_ORDER 0 //no huge PMD mappings without THP, the huge backing is single pages
+#endif
+#define PCD_PAGE_SHARED XA_MARK_0 //entry shared copy on write with another backing (or index)
+
+//************************* FUNCTIONS *****************************//
+
+/* type is PCD_BACKING_*, nid the node pages come from (NUMA_NO_NODE: the allocating CPU's node) */
+int pcd_backing_init(struct pcd_backing *backing, int type, int nid)
+{
+    struct file *shmem;
+
+    xa_init(&backing->pages);
+    atomic_long_set(&backing->nr_resident,0);
+    backing->type = type;
+    backing->nid = nid;
+    backing->shmem = NULL;
+    backing->cow = false;
+    if (type != PCD_BACKING_SHMEM)
+        return PCD_DRV_SUCCESS;
+
+    /* sized to the max once, the device size is enforced above us. VM_NORESERVE: no commit charge up front */
+    shmem = shmem_file_setup("pcdev",MAX_LFS_FILESIZE,VM_NORESERVE);
+    if (IS_ERR(shmem))
+        return PTR_ERR(shmem);
+    backing->shmem = shmem;
+    return PCD_DRV_SUCCESS;
+}
+
+/* put_page, not free: pages still mapped by a user (mmap) stay alive until unmapped */
+void pcd_backing_free(struct pcd_backing *backing)
+{
+    struct page *page;
+    unsigned long index;
+
+    if (backing->shmem)
+    {
+        fput(backing->shmem);
+        backing->shmem = NULL;
+        return;
+    }
+    xa_for_each(&backing->pages,index,page)
+        put_page(page);
+    xa_destroy(&backing->pages);
+    atomic_long_set(&backing->nr_resident,0);
+}
+
+/* Pages currently in memory */
+unsigned long pcd_backing_resident(struct pcd_backing *backing)
+{
+    if (backing->shmem)
+        return READ_ONCE(backing->shmem->f_mapping->nrpages); //swapped out pages don't count
+    return atomic_long_read(&backing->nr_resident);
+}
+
+/* Referenced page at index, NULL for a hole */
+static struct page *pcd_backing_lookup(struct pcd_backing *backing, pgoff_t index)
+{
+    struct page *page;
+
+    rcu_read_lock();
+repeat:
+    page = xa_load(&backing->pages,index);
+    /* huge folio subpages: the refcount lives in the head */
+    if (page && !get_page_unless_zero(compound_head(page)))
+        goto repeat;
+    /* punched and reused between the load and the ref */
+    if (page && unlikely(page != xa_load(&backing->pages,index)))
+    {
+        put_page(page);
+        goto repeat;
+    }
+    rcu_read_unlock();
+    return page;
+}
+
+/*
+ * Is page, found at index, only this backing's: no copy on write sharing going on.
+ * Stable under the page lock (sharing takes it) and the range lock of the page.
+ */
+bool pcd_backing_page_private(struct pcd_backing *backing, pgoff_t index, struct page *page)
+{
+    if (!READ_ONCE(backing->cow))
+        return true;
+    return (xa_load(&backing->pages,index) == page) && !xa_get_mark(&backing->pages,index,PCD_PAGE_SHARED);
+}
+
+/*
+ * Replace the shared page at index by a private copy. Returns the copy referenced, NULL when the entry
+ * changed meanwhile (look it up again), ERR_PTR(-ENOMEM). Caller holds the range lock of the page.
+ */
+static struct page *pcd_backing_unshare(struct pcd_backing *backing, pgoff_t index, struct page *page, gfp_t gfp)
+{
+    struct page *copy, *cur;
+
+    copy = alloc_pages_node(backing->nid,gfp,0);
+    if (!copy)
+        return ERR_PTR(-ENOMEM);
+    copy_highpage(copy,page);
+    get_page(copy); //one ref for the array, one for the caller
+    xa_lock(&backing->pages);
+    cur = __xa_cmpxchg(&backing->pages,index,page,copy,GFP_KERNEL);
+    if (cur == page)
+        __xa_clear_mark(&backing->pages,index,PCD_PAGE_SHARED);
+    xa_unlock(&backing->pages);
+    if (cur != page)
+    {
+        put_page(copy);
+        put_page(copy);
+        return xa_is_err(cur) ? ERR_PTR(xa_err(cur)) : NULL;
+    }
+    put_page(page); //the array's ref, the other sharers hold their own
+    return copy;
+}
+
+/*
+ * Referenced page at index. Holes return NULL, or get a zeroed page allocated when alloc is set.
+ * alloc means the caller writes the page: a shared page is unshared first, the page returned is private.
+ * Returns ERR_PTR(-ENOMEM) when an allocation fails.
+ * Shmem has no holes at this level, the page is always there (allocated or swapped in), or an ERR_PTR.
+ */
+struct page *pcd_backing_get_page(struct pcd_backing *backing, pgoff_t index, bool alloc)
+{
+    struct page *page, *old;
+
+    if (backing->shmem)
+        return shmem_read_mapping_page(backing->shmem->f_mapping,index);
+
+    for (;;)
+    {
+        page = pcd_backing_lookup(backing,index);
+        if (page && alloc && !pcd_backing_page_private(backing,index,page))
+        {
+            /* about to be written: the other sharers keep the old page */
+            old = pcd_backing_unshare(backing,index,page,GFP_HIGHUSER);
+            put_page(page);
+            if (!old)
+                continue; //unshared by someone else meanwhile
+            return old;
+        }
+        if (page || !alloc)
+            return page;
+
+        page = alloc_pages_node(backing->nid,GFP_HIGHUSER | __GFP_ZERO,0);
+        if (!page)
+            return ERR_PTR(-ENOMEM);
+        get_page(page); //one ref for the array, one for the caller
+        old = xa_cmpxchg(&backing->pages,index,NULL,page,GFP_KERNEL);
+        if (!old)
+        {
+            atomic_long_inc(&backing->nr_resident);
+            return page;
+        }
+        put_page(page);
+        put_page(page);
+        if (xa_is_err(old))
+            return ERR_PTR(xa_err(old));
+        /* lost the race to another writer/fault, use theirs */
+    }
+}
+
+/* Zero [start,end) of the resident pages, holes are zero already */
+static void pcd_backing_zero(struct pcd_backing *backing, loff_t start, loff_t end)
+{
+    struct page *page, *copy;
+    size_t chunk;
+
+    while (start < end)
+    {
+        chunk = min_t(loff_t,PAGE_SIZE - offset_in_page(start),end - start);
+        page = pcd_backing_lookup(backing,start >> PAGE_SHIFT);
+        while (page && !pcd_backing_page_private(backing,start >> PAGE_SHIFT,page))
+        {
+            /* punch/truncate can't fail, the copy can't either (a single page) */
+            copy = pcd_backing_unshare(backing,start >> PAGE_SHIFT,page,GFP_HIGHUSER | __GFP_NOFAIL);
+            put_page(page);
+            page = IS_ERR_OR_NULL(copy) ? pcd_backing_lookup(backing,start >> PAGE_SHIFT) : copy;
+        }
+        if (page)
+        {
+            zero_user_segment(page,offset_in_page(start),offset_in_page(start) + chunk);
+            put_page(page);
+        }
+        start += chunk;
+    }
+}
+
+/* Drop the pages [first,last] */
+static void pcd_backing_erase(struct pcd_backing *backing, pgoff_t first, pgoff_t last)
+{
+    struct page *page;
+    unsigned long index;
+
+    xa_for_each_range(&backing->pages,index,page,first,last)
+    {
+        if (xa_erase(&backing->pages,index) == page)
+        {
+            atomic_long_dec(&backing->nr_resident);
+            put_page(page);
+        }
+        cond_resched();
+    }
+}
+
+/*
+ * Punch a hole in [start,end): whole pages are released, partial pages at the edges are zeroed.
+ * Preallocated backings only zero the range. Caller holds the byte range lock over [start,end).
+ */
+void pcd_backing_punch(struct pcd_backing *backing, loff_t start, loff_t end)
+{
+    loff_t hole_start = round_up(start,PAGE_SIZE);
+    loff_t hole_end = round_down(end,PAGE_SIZE);
+
+    if (backing->shmem)
+    {
+        shmem_truncate_range(file_inode(backing->shmem),start,end - 1);
+        return;
+    }
+    if ((backing->type != PCD_BACKING_SPARSE) || (hole_start >= hole_end)) //preallocated: zero, keep the layout
+    {
+        pcd_backing_zero(backing,start,end);
+        return;
+    }
+    pcd_backing_zero(backing,start,hole_start);
+    pcd_backing_zero(backing,hole_end,end);
+    pcd_backing_erase(backing,hole_start >> PAGE_SHIFT,(hole_end >> PAGE_SHIFT) - 1);
+}
+
+/* Shrink to size: everything past it goes, so a later grow reads zeroes. Caller holds the range lock from size to the old end */
+void pcd_backing_truncate(struct pcd_backing *backing, loff_t size)
+{
+    if (backing->shmem)
+    {
+        shmem_truncate_range(file_inode(backing->shmem),size,(loff_t)-1);
+        return;
+    }
+    pcd_backing_zero(backing,size,round_up(size,PAGE_SIZE));
+    pcd_backing_erase(backing,DIV_ROUND_UP_ULL(size,PAGE_SIZE),ULONG_MAX);
+}
+
+/* Store a run of 1 << order pages at index, one array ref each: a split run, or a compound (huge) page */
+static int pcd_backing_store_run(struct pcd_backing *backing, pgoff_t index, struct page *page, unsigned int order)
+{
+    unsigned long i, nr = 1UL << order;
+    int ret;
+
+    if (PageCompound(page))
+        page_ref_add(page,nr - 1); //a compound page keeps all its refs on the head
+    else
+        split_page(page,order); //order 0 pages from here on, released one by one like any other
+    for (i = 0; i < nr; i++)
+    {
+        ret = xa_err(xa_store(&backing->pages,index + i,page + i,GFP_KERNEL));
+        if (ret)
+        {
+            for (; i < nr; i++)
+                put_page(page + i);
+            return ret;
+        }
+        atomic_long_inc(&backing->nr_resident);
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+/* Huge backing: the PMD range at index as one folio, as single pages when there is none to be had or it's the tail */
+static long pcd_backing_populate_huge(struct pcd_backing *backing, pgoff_t index, pgoff_t nr)
+{
+    unsigned long i, n = min_t(pgoff_t,1UL << PCD_HUGE_ORDER,nr - index);
+    struct page *page = NULL;
+    int ret;
+
+    if (PCD_HUGE_ORDER && (n == (1UL << PCD_HUGE_ORDER)))
+        page = alloc_pages_node(backing->nid,GFP_HIGHUSER | __GFP_ZERO | __GFP_COMP | __GFP_NORETRY | __GFP_NOWARN,
+                                PCD_HUGE_ORDER);
+    if (page)
+    {
+        ret = pcd_backing_store_run(backing,index,page,PCD_HUGE_ORDER);
+        return ret ? ret : n;
+    }
+    for (i = 0; i < n; i++)
+    {
+        page = pcd_backing_get_page(backing,index + i,true);
+        if (IS_ERR(page))
+            return PTR_ERR(page);
+        put_page(page);
+    }
+    return n;
+}
+
+/*
+ * Allocate every page of [0,size) up front (pages/contiguous/huge backings, org,prefault).
+ * Contiguous takes the largest runs it can get, stepping down to single pages when memory is fragmented.
+ * Runs stay naturally aligned: the order only ever goes down, huge ranges are all PMD sized.
+ */
+int pcd_backing_populate(struct pcd_backing *backing, loff_t size)
+{
+    pgoff_t index = 0, nr = DIV_ROUND_UP_ULL(size,PAGE_SIZE);
+    unsigned int order = PCD_CONTIG_ORDER;
+    struct page *page;
+    long done;
+    int ret;
+
+    while (index < nr)
+    {
+        if (fatal_signal_pending(current))
+            return -EINTR;
+        if (backing->type == PCD_BACKING_HUGE)
+        {
+            done = pcd_backing_populate_huge(backing,index,nr);
+            if (done < 0)
+                return done;
+            index += done;
+            cond_resched();
+            continue;
+        }
+        if (backing->type != PCD_BACKING_CONTIG)
+        {
+            page = pcd_backing_get_page(backing,index,true);
+            if (IS_ERR(page))
+                return PTR_ERR(page);
+            put_page(page);
+            index++;
+            cond_resched();
+            continue;
+        }
+
+        while (order && ((1UL << order) > nr - index))
+            order--;
+        page = alloc_pages_node(backing->nid,GFP_HIGHUSER | __GFP_ZERO | (order ? __GFP_NORETRY | __GFP_NOWARN : 0),order);
+        if (!page)
+        {
+            if (!order)
+                return -ENOMEM;
+            order--;
+            continue;
+        }
+        ret = pcd_backing_store_run(backing,index,page,order);
+        if (ret)
+            return ret;
+        index += 1UL << order;
+        cond_resched();
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+/*
+ * Make dst match src over the pages covering [start,end): whole pages are copied, src holes become holes.
+ * Neither may be shmem. Returns -ENOMEM when a dst page can't be allocated.
+ */
+int pcd_backing_copy(struct pcd_backing *dst, struct pcd_backing *src, loff_t start, loff_t end)
+{
+    pgoff_t index = start >> PAGE_SHIFT;
+    pgoff_t last = (end - 1) >> PAGE_SHIFT;
+    struct page *spage, *dpage;
+
+    for (; index <= last; index++)
+    {
+        spage = pcd_backing_lookup(src,index);
+        if (!spage)
+        {
+            pcd_backing_punch(dst,(loff_t)index << PAGE_SHIFT,(loff_t)(index + 1) << PAGE_SHIFT);
+            continue;
+        }
+        dpage = pcd_backing_get_page(dst,index,true);
+        if (IS_ERR(dpage))
+        {
+            put_page(spage);
+            return PTR_ERR(dpage);
+        }
+        copy_highpage(dpage,spage);
+        put_page(dpage);
+        put_page(spage);
+        cond_resched();
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+/*
+ * Make dst's page at dindex the very page src has at sindex, copy on write for both.
+ * Returns 1 when shared (or both holes now), 0 when the page has to be copied instead, -errno.
+ * Caller holds the range locks over both pages.
+ */
+static int pcd_backing_share_page(struct pcd_backing *dst, pgoff_t dindex, struct pcd_backing *src, pgoff_t sindex)
+{
+    struct page *page, *old;
+    int ret = 1;
+
+    page = pcd_backing_lookup(src,sindex);
+    if (!page)
+    {
+        pcd_backing_erase(dst,dindex,dindex);
+        return 1;
+    }
+    /* faults map pages locked and only when private: holding the lock, no mapping can appear under us */
+    lock_page(page);
+    if (page_mapped(page))
+    {
+        ret = 0; //stores through the mapping would go to both devices
+        goto unlock;
+    }
+    xa_lock(&src->pages);
+    __xa_set_mark(&src->pages,sindex,PCD_PAGE_SHARED);
+    xa_unlock(&src->pages);
+
+    get_page(page); //dst's array ref
+    xa_lock(&dst->pages);
+    old = __xa_store(&dst->pages,dindex,page,GFP_KERNEL);
+    if (!xa_is_err(old))
+        __xa_set_mark(&dst->pages,dindex,PCD_PAGE_SHARED);
+    xa_unlock(&dst->pages);
+    if (xa_is_err(old))
+    {
+        put_page(page);
+        ret = xa_err(old);
+        goto unlock;
+    }
+    if (old)
+        put_page(old); //a mapping of the old page keeps it until the caller zaps it (pcd_copy_range)
+    else
+        atomic_long_inc(&dst->nr_resident);
+unlock:
+    unlock_page(page);
+    put_page(page);
+    return ret;
+}
+
+/*
+ * Copy len bytes of src at src_pos into dst at dst_pos, src holes become holes.
+ * share: whole pages go over by reference, copy on write, when both backings are sparse and the two
+ * positions have the same offset in their page. The rest is copied.
+ * Caller holds the range locks of both ranges, they don't overlap. Returns bytes copied, short or -errno on error.
+ */
+ssize_t pcd_backing_clone(struct pcd_backing *dst, loff_t dst_pos, struct pcd_backing *src, loff_t src_pos, size_t len, bool share)
+{
+    struct iov_iter iter;
+    struct bio_vec bv;
+    struct page *page;
+    size_t done = 0, chunk;
+    ssize_t ret = 0;
+
+    share = share && (dst->type == PCD_BACKING_SPARSE) && (src->type == PCD_BACKING_SPARSE) &&
+            (offset_in_page(dst_pos) == offset_in_page(src_pos));
+    if (share)
+    {
+        WRITE_ONCE(src->cow,true);
+        WRITE_ONCE(dst->cow,true);
+    }
+    while (done < len)
+    {
+        if (fatal_signal_pending(current))
+        {
+            ret = -EINTR;
+            break;
+        }
+        chunk = min_t(size_t,PAGE_SIZE - offset_in_page(src_pos),len - done);
+        if (share && (chunk == PAGE_SIZE))
+        {
+            ret = pcd_backing_share_page(dst,dst_pos >> PAGE_SHIFT,src,src_pos >> PAGE_SHIFT);
+            if (ret < 0)
+                break;
+            if (ret)
+                goto next;
+        }
+
+        page = pcd_backing_get_page(src,src_pos >> PAGE_SHIFT,false);
+        if (IS_ERR(page))
+        {
+            ret = PTR_ERR(page);
+            break;
+        }
+        if (!page)
+        {
+            pcd_backing_punch(dst,dst_pos,dst_pos + chunk);
+            goto next;
+        }
+        bv.bv_page = page;
+        bv.bv_offset = offset_in_page(src_pos);
+        bv.bv_len = chunk;
+        iov_iter_bvec(&iter,WRITE,&bv,1,chunk);
+        ret = pcd_backing_from_iter(dst,dst_pos,chunk,&iter,false);
+        put_page(page);
+        if (ret < 0)
+            break;
+        if ((size_t)ret < chunk)
+        {
+            done += ret;
+            break;
+        }
+next:
+        done += chunk;
+        src_pos += chunk;
+        dst_pos += chunk;
+        cond_resched();
+    }
+    return done ? done : ret;
+}
+
+/* Shmem: the file's own read_iter/write_iter over count bytes of the iter */
+static ssize_t pcd_backing_shmem_rw(struct pcd_backing *backing, loff_t pos, size_t count, struct iov_iter *iter, bool write)
+{
+    size_t rest = iov_iter_count(iter) - count;
+    struct kiocb kiocb;
+    ssize_t ret;
+
+    init_sync_kiocb(&kiocb,backing->shmem);
+    kiocb.ki_pos = pos;
+    iov_iter_truncate(iter,count);
+    if (write)
+        ret = backing->shmem->f_op->write_iter(&kiocb,iter);
+    else
+        ret = backing->shmem->f_op->read_iter(&kiocb,iter);
+    iov_iter_reexpand(iter,iov_iter_count(iter) + rest);
+    return ret;
+}
+
+/* Copy count bytes at pos out to the iter page by page, holes read as zeroes. Returns bytes copied, short on a fault */
+size_t pcd_backing_to_iter(struct pcd_backing *backing, loff_t pos, size_t count, struct iov_iter *to)
+{
+    size_t done = 0, chunk, copied;
+    struct page *page;
+    ssize_t ret;
+
+    if (backing->shmem)
+    {
+        ret = pcd_backing_shmem_rw(backing,pos,count,to,false);
+        return (ret > 0) ? ret : 0;
+    }
+    while (done < count)
+    {
+        chunk = min_t(size_t,PAGE_SIZE - offset_in_page(pos),count - done);
+        page = pcd_backing_lookup(backing,pos >> PAGE_SHIFT);
+        copied = copy_page_to_iter(page ? page : ZERO_PAGE(0),offset_in_page(pos),chunk,to);
+        if (page)
+            put_page(page);
+        done += copied;
+        pos += copied;
+        if (copied < chunk)
+            break;
+        cond_resched();
+    }
+    return done;
+}
+
+/*
+ * Copy count bytes from the iter into the device at pos page by page, allocating pages on first write.
+ * nowait: nothing is allocated, the copy stops short at a hole or a shared page. Shmem, whose write may always
+ * sleep, copies nothing.
+ * Returns bytes copied (short on a fault), -ENOMEM if nothing could be copied for lack of memory,
+ * -EAGAIN if nowait and nothing could be copied without allocating.
+ */
+ssize_t pcd_backing_from_iter(struct pcd_backing *backing, loff_t pos, size_t count, struct iov_iter *from, bool nowait)
+{
+    size_t done = 0, chunk, copied;
+    struct page *page;
+
+    if (backing->shmem)
+        return nowait ? -EAGAIN : pcd_backing_shmem_rw(backing,pos,count,from,true);
+    while (done < count)
+    {
+        chunk = min_t(size_t,PAGE_SIZE - offset_in_page(pos),count - done);
+        page = pcd_backing_get_page(backing,pos >> PAGE_SHIFT,!nowait);
+        if (nowait && page && !pcd_backing_page_private(backing,pos >> PAGE_SHIFT,page))
+        {
+            put_page(page); //would have to be unshared
+            page = NULL;
+        }
+        if (nowait && !page)
+            return done ? done : -EAGAIN;
+        if (IS_ERR(page))
+            return done ? done : PTR_ERR(page);
+        copied = copy_page_from_iter(page,offset_in_page(pos),chunk,from);
+        put_page(page);
+        done += copied;
+        pos += copied;
+        if (copied < chunk)
+            break;
+        cond_resched();
+    }
+    return done;
+}
+
+/* SEEK_DATA/SEEK_HOLE in page granularity. The end of the device is an implicit hole */
+loff_t pcd_backing_seek_data_hole(struct pcd_backing *backing, loff_t offset, loff_t size, int whence)
+{
+    unsigned long index = offset >> PAGE_SHIFT;
+    unsigned long last = (size - 1) >> PAGE_SHIFT;
+    loff_t ret;
+
+    if ((offset < 0) || (offset >= size))
+        return -ENXIO;
+
+    if (backing->shmem)
+    {
+        /* tmpfs knows its holes. Its size is the max, ours ends earlier */
+        ret = vfs_llseek(backing->shmem,offset,whence);
+        if ((ret >= size) && (whence == SEEK_DATA))
+            return -ENXIO;
+        return (ret < 0) ? ret : min_t(loff_t,ret,size);
+    }
+
+    if (whence == SEEK_DATA)
+    {
+        if (!xa_find(&backing->pages,&index,last,XA_PRESENT))
+            return -ENXIO;
+        return max_t(loff_t,offset,(loff_t)index << PAGE_SHIFT);
+    }
+
+    /* SEEK_HOLE: walk resident pages until the first gap */
+    while ((index <= last) && xa_load(&backing->pages,index))
+    {
+        index++;
+        cond_resched();
+    }
+    return min_t(loff_t,size,max_t(loff_t,offset,(loff_t)index << PAGE_SHIFT));
+}
@@ -0,0 +1,286 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*
+ * Runtime pcdev instances through configfs:
+ *   mkdir /sys/kernel/config/pcd/mydev
+ *   echo 1048576 > mydev/size; echo 0x11 > mydev/perm; echo SN123 > mydev/serial_number; echo fifo > mydev/mode
+ *   echo 1 > mydev/enable      registers a "pcdev-cfs" platform device, the driver probes it like any other
+ *   echo 0 > mydev/enable      unregisters it (rmdir does the same)
+ * Attributes are only writable while the item is disabled.
+ */
+
+//*************************Pre-processor macros*****************************//
+#define PCD_CFS_SERIAL_MAX 32
+
+//************************* STRUCTS *****************************//
+
+struct pcd_cfs_item
+{
+    struct config_item item;
+    struct mutex lock; //attributes vs enable
+    struct pcdev_platform_data pdata; //serial_number points to serial below
+    char serial[PCD_CFS_SERIAL_MAX];
+    struct platform_device *pdev; //NULL while disabled
+};
+
+//************************* FUNCTIONS *****************************//
+
+static inline struct pcd_cfs_item *to_pcd_cfs_item(struct config_item *item)
+{
+    return container_of(item,struct pcd_cfs_item,item);
+}
+
+static ssize_t pcd_cfs_size_show(struct config_item *item, char *page)
+{
+    return sprintf(page,"%llu\n",to_pcd_cfs_item(item)->pdata.size);
+}
+
+static ssize_t pcd_cfs_size_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfs_item *cfs = to_pcd_cfs_item(item);
+    u64 size;
+    int ret;
+
+    if(ret = kstrtoull(page,0,&size))
+        return ret;
+    if((size == 0) || (size > LLONG_MAX))
+        return -EINVAL;
+    mutex_lock(&cfs->lock);
+    if(cfs->pdev)
+    {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY; //disable first
+    }
+    cfs->pdata.size = size;
+    mutex_unlock(&cfs->lock);
+    return count;
+}
+
+static ssize_t pcd_cfs_perm_show(struct config_item *item, char *page)
+{
+    return sprintf(page,"0x%x\n",to_pcd_cfs_item(item)->pdata.perm);
+}
+
+static ssize_t pcd_cfs_perm_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfs_item *cfs = to_pcd_cfs_item(item);
+    int perm;
+    int ret;
+
+    if(ret = kstrtoint(page,0,&perm))
+        return ret;
+    if((perm != DEV_DRV_PERM_RDONLY) && (perm != DEV_DRV_PERM_WRONLY) && (perm != DEV_DRV_PERM_RDWR))
+        return -EINVAL;
+    mutex_lock(&cfs->lock);
+    if(cfs->pdev)
+    {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY; //disable first
+    }
+    cfs->pdata.perm = perm;
+    mutex_unlock(&cfs->lock);
+    return count;
+}
+
+static ssize_t pcd_cfs_serial_number_show(struct config_item *item, char *page)
+{
+    return sprintf(page,"%s\n",to_pcd_cfs_item(item)->serial);
+}
+
+static ssize_t pcd_cfs_serial_number_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfs_item *cfs = to_pcd_cfs_item(item);
+    size_t len = strcspn(page,"\n");
+
+    if((len == 0) || (len >= PCD_CFS_SERIAL_MAX))
+        return -EINVAL;
+    mutex_lock(&cfs->lock);
+    if(cfs->pdev)
+    {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY; //disable first
+    }
+    strscpy(cfs->serial,page,len + 1);
+    mutex_unlock(&cfs->lock);
+    return count;
+}
+
+static ssize_t pcd_cfs_mode_show(struct config_item *item, char *page)
+{
+    return sprintf(page,"%s\n",pcd_mode_names[to_pcd_cfs_item(item)->pdata.mode]);
+}
+
+static ssize_t pcd_cfs_mode_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfs_item *cfs = to_pcd_cfs_item(item);
+    int mode;
+
+    mode = sysfs_match_string(pcd_mode_names,page);
+    if(mode < 0)
+        return mode;
+    mutex_lock(&cfs->lock);
+    if(cfs->pdev)
+    {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY; //disable first
+    }
+    cfs->pdata.mode = mode;
+    mutex_unlock(&cfs->lock);
+    return count;
+}
+
+static ssize_t pcd_cfs_enable_show(struct config_item *item, char *page)
+{
+    return sprintf(page,"%d\n",to_pcd_cfs_item(item)->pdev ? 1 : 0);
+}
+
+/* Caller holds cfs->lock */
+static int pcd_cfs_enable(struct pcd_cfs_item *cfs)
+{
+    struct platform_device_info info =
+    {
+        .name = "pcdev-cfs",
+        .id = PLATFORM_DEVID_AUTO,
+        .data = &cfs->pdata, //copied by the platform core
+        .size_data = sizeof(cfs->pdata)
+    };
+    struct platform_device *pdev;
+
+    if(!cfs->serial[0])
+        return -EINVAL; //every pcdev has a serial number
+    pdev = platform_device_register_full(&info);
+    if(IS_ERR(pdev))
+        return PTR_ERR(pdev);
+    cfs->pdev = pdev;
+    return PCD_DRV_SUCCESS;
+}
+
+/* Caller holds cfs->lock */
+static void pcd_cfs_disable(struct pcd_cfs_item *cfs)
+{
+    if(!cfs->pdev)
+        return;
+    platform_device_unregister(cfs->pdev);
+    cfs->pdev = NULL;
+}
+
+static ssize_t pcd_cfs_enable_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfs_item *cfs = to_pcd_cfs_item(item);
+    bool enable;
+    int ret;
+
+    if(ret = kstrtobool(page,&enable))
+        return ret;
+    mutex_lock(&cfs->lock);
+    if(enable && !cfs->pdev)
+        ret = pcd_cfs_enable(cfs);
+    else if(!enable)
+        pcd_cfs_disable(cfs);
+    mutex_unlock(&cfs->lock);
+    return ret ? ret : count;
+}
+
+CONFIGFS_ATTR(pcd_cfs_,size);
+CONFIGFS_ATTR(pcd_cfs_,perm);
+CONFIGFS_ATTR(pcd_cfs_,serial_number);
+CONFIGFS_ATTR(pcd_cfs_,mode);
+CONFIGFS_ATTR(pcd_cfs_,enable);
+
+static struct configfs_attribute *pcd_cfs_attrs[] =
+{
+    &pcd_cfs_attr_size,
+    &pcd_cfs_attr_perm,
+    &pcd_cfs_attr_serial_number,
+    &pcd_cfs_attr_mode,
+    &pcd_cfs_attr_enable,
+    NULL
+};
+
+static void pcd_cfs_item_release(struct config_item *item)
+{
+    kfree(to_pcd_cfs_item(item));
+}
+
+static struct configfs_item_operations pcd_cfs_item_ops =
+{
+    .release = pcd_cfs_item_release
+};
+
+static const struct config_item_type pcd_cfs_item_type =
+{
+    .ct_item_ops = &pcd_cfs_item_ops,
+    .ct_attrs = pcd_cfs_attrs,
+    .ct_owner = THIS_MODULE
+};
+
+/* mkdir: a disabled item with defaults (1 page, read/write, array mode, sparse backing) */
+static struct config_item *pcd_cfs_make_item(struct config_group *group, const char *name)
+{
+    struct pcd_cfs_item *cfs;
+
+    cfs = kzalloc(sizeof(*cfs),GFP_KERNEL);
+    if(!cfs)
+        return ERR_PTR(-ENOMEM);
+    mutex_init(&cfs->lock);
+    cfs->pdata.size = PAGE_SIZE;
+    cfs->pdata.perm = DEV_DRV_PERM_RDWR;
+    cfs->pdata.mode = PCD_MODE_ARRAY;
+    cfs->pdata.backing = PCD_BACKING_SPARSE;
+    cfs->pdata.numa_node = NUMA_NO_NODE;
+    cfs->pdata.serial_number = cfs->serial;
+    config_item_init_type_name(&cfs->item,name,&pcd_cfs_item_type);
+    return &cfs->item;
+}
+
+/* rmdir: take the device down with the item */
+static void pcd_cfs_drop_item(struct config_group *group, struct config_item *item)
+{
+    struct pcd_cfs_item *cfs = to_pcd_cfs_item(item);
+
+    mutex_lock(&cfs->lock);
+    pcd_cfs_disable(cfs);
+    mutex_unlock(&cfs->lock);
+    config_item_put(item);
+}
+
+static struct configfs_group_operations pcd_cfs_group_ops =
+{
+    .make_item = pcd_cfs_make_item,
+    .drop_item = pcd_cfs_drop_item
+};
+
+static const struct config_item_type pcd_cfs_group_type =
+{
+    .ct_group_ops = &pcd_cfs_group_ops,
+    .ct_owner = THIS_MODULE
+};
+
+static struct configfs_subsystem pcd_cfs_subsys =
+{
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = "pcd",
+            .ci_type = &pcd_cfs_group_type
+        }
+    }
+};
+
+static bool pcd_cfs_registered;
+
+int pcd_configfs_init(void)
+{
+    int ret;
+
+    config_group_init(&pcd_cfs_subsys.su_group);
+    mutex_init(&pcd_cfs_subsys.su_mutex);
+    ret = configfs_register_subsystem(&pcd_cfs_subsys);
+    pcd_cfs_registered = !ret;
+    return ret;
+}
+
+void pcd_configfs_exit(void)
+{
+    if(pcd_cfs_registered)
+        configfs_unregister_subsystem(&pcd_cfs_subsys);
+}
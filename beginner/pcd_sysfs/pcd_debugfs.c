@@ -0,0 +1,136 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*
+ * Latency histograms of the file ops in debugfs:
+ *   /sys/kernel/debug/pcd/pcdev-N/latency        table of all non empty histograms
+ *   /sys/kernel/debug/pcd/pcdev-N/latency_reset  write anything to clear
+ * One histogram per op and transfer size class, log2 buckets of nanoseconds (local_clock).
+ * Buckets are per cpu, recording is a single this_cpu_inc.
+ */
+
+//************************* GLOBALS *****************************//
+
+static const char * const pcd_lat_op_names[PCD_LAT_OPS] =
+{
+    [PCD_LAT_OPEN] = "open",
+    [PCD_LAT_READ] = "read",
+    [PCD_LAT_WRITE] = "write",
+    [PCD_LAT_LSEEK] = "lseek"
+};
+
+static const char * const pcd_lat_class_names[PCD_LAT_CLASSES] =
+{
+    "<=512B",
+    "<=4KiB",
+    "<=64KiB",
+    ">64KiB"
+};
+
+//************************* FUNCTIONS *****************************//
+
+/* Transfer size class of a request. open/lseek always land in class 0 */
+static int pcd_lat_class(size_t bytes)
+{
+    if (bytes <= 512)
+        return 0;
+    if (bytes <= SZ_4K)
+        return 1;
+    if (bytes <= SZ_64K)
+        return 2;
+    return 3;
+}
+
+void pcd_lat_record(struct pcdev_private_data *pcdev_data, enum pcd_lat_op op, size_t bytes, u64 start_ns)
+{
+    u64 ns = local_clock() - start_ns;
+    int bucket = min_t(int,fls64(ns),PCD_LAT_BUCKETS - 1); //bucket b: [2^(b-1), 2^b) ns
+
+    this_cpu_inc(pcdev_data->lat->bucket[op][pcd_lat_class(bytes)][bucket]);
+}
+
+static int pcd_lat_show(struct seq_file *s, void *unused)
+{
+    struct pcdev_private_data *dev_data = s->private;
+    u64 sum[PCD_LAT_BUCKETS];
+    u64 total;
+    int op, cls, b, cpu;
+
+    for (op = 0; op < PCD_LAT_OPS; op++)
+    {
+        for (cls = 0; cls < PCD_LAT_CLASSES; cls++)
+        {
+            total = 0;
+            for (b = 0; b < PCD_LAT_BUCKETS; b++)
+            {
+                sum[b] = 0;
+                for_each_possible_cpu(cpu)
+                    sum[b] += per_cpu_ptr(dev_data->lat,cpu)->bucket[op][cls][b];
+                total += sum[b];
+            }
+            if (!total)
+                continue;
+
+            seq_printf(s,"%s %s: %llu samples\n",pcd_lat_op_names[op],
+                       (op == PCD_LAT_READ || op == PCD_LAT_WRITE) ? pcd_lat_class_names[cls] : "-",total);
+            seq_printf(s,"  %12s %12s %12s\n","from(ns)","to(ns)","count");
+            for (b = 0; b < PCD_LAT_BUCKETS; b++)
+            {
+                if (!sum[b])
+                    continue;
+                if (b == PCD_LAT_BUCKETS - 1)
+                    seq_printf(s,"  %12llu %12s %12llu\n",b ? 1ULL << (b - 1) : 0,"inf",sum[b]);
+                else
+                    seq_printf(s,"  %12llu %12llu %12llu\n",b ? 1ULL << (b - 1) : 0,1ULL << b,sum[b]);
+            }
+        }
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pcd_lat);
+
+static ssize_t pcd_lat_reset_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos)
+{
+    struct pcdev_private_data *dev_data = filep->private_data;
+    int cpu;
+
+    /* racing increments on other cpus may survive the clear, fine for a histogram */
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(dev_data->lat,cpu),0,sizeof(struct pcd_lat_hist));
+    return count;
+}
+
+static const struct file_operations pcd_lat_reset_fops =
+{
+    .open = simple_open,
+    .write = pcd_lat_reset_write,
+    .llseek = noop_llseek,
+    .owner = THIS_MODULE
+};
+
+/* Not devm, like the stats: files still open after remove keep recording */
+int pcd_lat_alloc(struct pcdev_private_data *dev_data)
+{
+    dev_data->lat = alloc_percpu(struct pcd_lat_hist);
+    if (!dev_data->lat)
+        return -ENOMEM;
+    return PCD_DRV_SUCCESS;
+}
+
+void pcd_lat_free(struct pcdev_private_data *dev_data)
+{
+    free_percpu(dev_data->lat);
+    dev_data->lat = NULL;
+}
+
+/* debugfs failures are not fatal, the calls below are no-ops on an error dentry */
+void pcd_debugfs_add(struct pcdev_private_data *dev_data, struct dentry *root, const char *name)
+{
+    dev_data->debugfs_dir = debugfs_create_dir(name,root);
+    debugfs_create_file("latency",S_IRUSR,dev_data->debugfs_dir,dev_data,&pcd_lat_fops);
+    debugfs_create_file("latency_reset",S_IWUSR,dev_data->debugfs_dir,dev_data,&pcd_lat_reset_fops);
+}
+
+void pcd_debugfs_remove(struct pcdev_private_data *dev_data)
+{
+    debugfs_remove_recursive(dev_data->debugfs_dir);
+}
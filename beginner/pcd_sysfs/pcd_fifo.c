@@ -0,0 +1,218 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_trace.h"
+
+/*
+ * FIFO (pipe) mode of a pcdev.
+ * The device buffer becomes a single producer / single consumer ring (kfifo style):
+ * head and tail are free running counters (unsigned long, so a ring is at most LONG_MAX bytes), the producer only moves head, the consumer only moves tail,
+ * and acquire/release ordering on them is all the synchronization the two sides need.
+ * Several readers (or several writers) on one device are serialized by rd_lock (wr_lock) so the
+ * ring itself always sees one consumer and one producer.
+ */
+
+//************************* FUNCTIONS *****************************//
+
+void pcd_fifo_init(struct pcd_fifo *fifo)
+{
+    fifo->head = 0;
+    fifo->tail = 0;
+    init_waitqueue_head(&fifo->rd_wq);
+    init_waitqueue_head(&fifo->wr_wq);
+    mutex_init(&fifo->rd_lock);
+    mutex_init(&fifo->wr_lock);
+}
+
+/* Drop the ring contents (mode switch). Caller holds buf_sem exclusive, the new mode is set: sleepers recheck it */
+void pcd_fifo_reset(struct pcd_fifo *fifo)
+{
+    fifo->head = 0;
+    fifo->tail = 0;
+    wake_up_interruptible_poll(&fifo->rd_wq,EPOLLIN|EPOLLRDNORM);
+    wake_up_interruptible_poll(&fifo->wr_wq,EPOLLOUT|EPOLLWRNORM);
+}
+
+static int pcd_fifo_lock(struct mutex *lock, bool nonblock)
+{
+    if (nonblock)
+        return mutex_trylock(lock) ? PCD_DRV_SUCCESS : -EAGAIN;
+    return mutex_lock_interruptible(lock);
+}
+
+/* Wakeup conditions, also true once the device left fifo mode or was removed: the sleeper goes and finds out */
+static bool pcd_fifo_readable(struct pcdev_private_data *pcdev_data)
+{
+    struct pcd_fifo *fifo = &pcdev_data->fifo;
+
+    return pcd_dev_left_mode(pcdev_data,PCD_MODE_FIFO) ||
+           (smp_load_acquire(&fifo->head) != READ_ONCE(fifo->tail));
+}
+
+static bool pcd_fifo_writable(struct pcdev_private_data *pcdev_data)
+{
+    struct pcd_fifo *fifo = &pcdev_data->fifo;
+
+    return pcd_dev_left_mode(pcdev_data,PCD_MODE_FIFO) ||
+           ((READ_ONCE(fifo->head) - smp_load_acquire(&fifo->tail)) < pcd_dev_size(pcdev_data));
+}
+
+/* Take buf_sem shared and check the device is (still) there and in fifo mode */
+static int pcd_fifo_buf_lock(struct pcdev_private_data *pcdev_data)
+{
+    down_read(&pcdev_data->buf_sem);
+    if (pcdev_data->dead)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -ENODEV;
+    }
+    if (pcdev_data->pdata.mode != PCD_MODE_FIFO)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -EIO; //mode switched under us, the ring storage is something else's now
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+ssize_t pcd_fifo_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    struct pcd_fifo *fifo = &pcdev_data->fifo;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(to);
+    size_t requested = count;
+    unsigned long size, head, tail, off, first;
+    ssize_t ret;
+
+    ret = pcd_fifo_lock(&fifo->rd_lock,nonblock);
+    if (ret)
+        goto out;
+
+    /* wait for data. buf_sem is only held while the ring is touched, never while sleeping */
+    for(;;)
+    {
+        ret = pcd_fifo_buf_lock(pcdev_data);
+        if (ret)
+            goto unlock;
+        head = smp_load_acquire(&fifo->head); //pairs with the producer's release: data is visible
+        tail = fifo->tail;
+        if (head != tail)
+            break;
+        up_read(&pcdev_data->buf_sem);
+        if (nonblock)
+        {
+            ret = -EAGAIN;
+            goto unlock;
+        }
+        ret = wait_event_interruptible(fifo->rd_wq,pcd_fifo_readable(pcdev_data));
+        if (ret)
+            goto unlock;
+    }
+
+    /* copy out at most what's there, in two chunks when it wraps */
+    size = pcd_dev_size(pcdev_data); //no resize in fifo mode
+    count = min_t(unsigned long,count,head - tail);
+    off = tail % size;
+    first = min_t(unsigned long,count,size - off);
+    ret = pcd_backing_to_iter(&pcdev_data->backing,off,first,to);
+    if ((ret == first) && (count > first))
+        ret += pcd_backing_to_iter(&pcdev_data->backing,0,count - first,to);
+    smp_store_release(&fifo->tail,tail + ret); //space is free only after the copy is done
+    up_read(&pcdev_data->buf_sem);
+
+    if (!ret)
+    {
+        ret = -EFAULT;
+        goto unlock;
+    }
+    if (wq_has_sleeper(&fifo->wr_wq))
+        wake_up_interruptible_poll(&fifo->wr_wq,EPOLLOUT|EPOLLWRNORM);
+
+unlock:
+    mutex_unlock(&fifo->rd_lock);
+out:
+    trace_pcd_read(MINOR(pcdev_data->dev_num),fifo->tail,count,ret);
+    pcd_stats_rw(pcdev_data,false,requested,ret);
+    return ret;
+}
+
+ssize_t pcd_fifo_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    struct pcd_fifo *fifo = &pcdev_data->fifo;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(from);
+    size_t requested = count;
+    unsigned long size, head, tail, off, first;
+    ssize_t ret, second;
+
+    ret = pcd_fifo_lock(&fifo->wr_lock,nonblock);
+    if (ret)
+        goto out;
+
+    /* wait for space. Pipe like: a partial write is fine as soon as some space is free */
+    for(;;)
+    {
+        ret = pcd_fifo_buf_lock(pcdev_data);
+        if (ret)
+            goto unlock;
+        size = pcd_dev_size(pcdev_data);
+        head = fifo->head;
+        tail = smp_load_acquire(&fifo->tail); //pairs with the consumer's release: slot is free
+        if ((head - tail) < size)
+            break;
+        up_read(&pcdev_data->buf_sem);
+        if (nonblock)
+        {
+            ret = -EAGAIN;
+            goto unlock;
+        }
+        ret = wait_event_interruptible(fifo->wr_wq,pcd_fifo_writable(pcdev_data));
+        if (ret)
+            goto unlock;
+    }
+
+    count = min_t(unsigned long,count,size - (head - tail));
+    off = head % size;
+    first = min_t(unsigned long,count,size - off);
+    ret = pcd_backing_from_iter(&pcdev_data->backing,off,first,from,false);
+    if ((ret == first) && (count > first))
+    {
+        second = pcd_backing_from_iter(&pcdev_data->backing,0,count - first,from,false);
+        if (second > 0)
+            ret += second;
+    }
+    if (ret > 0)
+        smp_store_release(&fifo->head,head + ret); //publish data to the consumer
+    up_read(&pcdev_data->buf_sem);
+
+    if (ret <= 0)
+    {
+        if (!ret)
+            ret = -EFAULT;
+        goto unlock;
+    }
+    if (wq_has_sleeper(&fifo->rd_wq))
+        wake_up_interruptible_poll(&fifo->rd_wq,EPOLLIN|EPOLLRDNORM);
+
+unlock:
+    mutex_unlock(&fifo->wr_lock);
+out:
+    trace_pcd_write(MINOR(pcdev_data->dev_num),fifo->head,count,ret);
+    pcd_stats_rw(pcdev_data,true,requested,ret);
+    return ret;
+}
+
+__poll_t pcd_fifo_poll(struct file *filep, poll_table *wait)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    struct pcd_fifo *fifo = &pcdev_data->fifo;
+    __poll_t mask = 0;
+
+    poll_wait(filep,&fifo->rd_wq,wait);
+    poll_wait(filep,&fifo->wr_wq,wait);
+
+    if (pcd_fifo_readable(pcdev_data))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (pcd_fifo_writable(pcdev_data))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
+}
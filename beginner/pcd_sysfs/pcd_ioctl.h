@@ -0,0 +1,178 @@
+#ifndef PCD_IOCTL_H
+#define PCD_IOCTL_H
+
+/*
+ * pcdev ioctls. Shared by the driver and user space (include it as is from a C program).
+ */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+//*************************Pre-processor macros*****************************//
+#define PCD_IOC_MAGIC 'P'
+
+/* pcd_copy_arg flags */
+#define PCD_COPY_SHARE 0x1 //share whole pages copy on write instead of copying them (sparse backings)
+
+/* pcd_io_desc ops */
+#define PCD_OP_READ 0
+#define PCD_OP_WRITE 1
+
+#define PCD_BATCH_MAX 1024 //descriptors per PCD_IOC_BATCH
+
+/* Submission/completion rings */
+#define PCD_RING_MAX_ENTRIES 4096 //SQ entries, the CQ may have twice that
+#define PCD_RING_SQPOLL 0x1 //pcd_ring_params flags: the device's polling thread consumes the SQ
+#define PCD_RING_NEED_WAKEUP 0x1 //pcd_ring_hdr flags: polling thread asleep, PCD_RING_IOC_ENTER to wake it
+
+//*************************Struct declarations*****************************//
+
+/* Byte range of a device */
+struct pcd_range_arg
+{
+    __u64 offset;
+    __u64 len;
+};
+
+/* Device to device copy, issued on the destination */
+struct pcd_copy_arg
+{
+    __s32 src_fd; //pcdev to copy from, open for reading
+    __u32 flags; //PCD_COPY_*
+    __u64 src_offset;
+    __u64 dst_offset;
+    __u64 len;
+};
+
+/* One read or write of a batch. result is filled in: bytes transferred (short at the end of the device) or -errno */
+struct pcd_io_desc
+{
+    __u32 op; //PCD_OP_*
+    __u32 reserved; //must be 0
+    __u64 offset;
+    __u64 len;
+    __u64 buf; //user buffer
+    __s64 result;
+};
+
+/* Array of nr descriptors run by one PCD_IOC_BATCH */
+struct pcd_batch_arg
+{
+    __u64 descs; //struct pcd_io_desc *
+    __u32 nr;
+    __u32 flags; //must be 0
+};
+
+/* PCD_URING_CMD_RESIZE payload */
+struct pcd_resize_arg
+{
+    __u64 size; //new size in bytes
+};
+
+/* PCD_URING_CMD_STATS payload */
+struct pcd_stats_arg
+{
+    __u64 buf; //struct pcd_stats_snap * filled in
+};
+
+/* Counters of the stats sysfs group (since the last reset), the size and resident memory, all read at once */
+struct pcd_stats_snap
+{
+    __u64 reads;
+    __u64 writes;
+    __u64 seeks;
+    __u64 bytes_read;
+    __u64 bytes_written;
+    __u64 short_transfers;
+    __u64 efault;
+    __u64 enomem;
+    __u64 opens;
+    __u64 huge_faults;
+    __u64 small_faults;
+    __u64 size;
+    __u64 resident_bytes;
+};
+
+/*
+ * Ring pair set up by PCD_IOC_RING_SETUP, mapped from the ring fd at offset 0:
+ * struct pcd_ring_hdr, then sq_entries struct pcd_sqe at sq_off, then cq_entries struct pcd_cqe at cq_off.
+ * Indexes are free running, entry i sits at i & (entries - 1). User space writes SQEs and moves sq_tail
+ * (store release), the kernel posts a CQE per SQE in order and moves cq_tail, user space moves cq_head.
+ * Each index has a cache line of its own, so producer and consumer never share one.
+ */
+struct pcd_ring_hdr
+{
+    __u32 sq_head; //kernel: SQEs consumed up to here
+    __u32 pad0[15];
+    __u32 sq_tail; //user: SQEs written up to here
+    __u32 pad1[15];
+    __u32 cq_head; //user: CQEs reaped up to here
+    __u32 pad2[15];
+    __u32 cq_tail; //kernel: CQEs posted up to here
+    __u32 pad3[15];
+    __u32 flags; //PCD_RING_NEED_WAKEUP
+    __u32 sq_entries;
+    __u32 cq_entries;
+    __u32 pad4[13];
+};
+
+/* Submission entry, one cache line. Same fields as a batch descriptor */
+struct pcd_sqe
+{
+    __u32 op; //PCD_OP_*
+    __u32 reserved; //must be 0
+    __u64 offset;
+    __u64 len;
+    __u64 buf; //user buffer, in the address space that set the ring up
+    __u64 user_data; //handed back in the CQE
+    __u64 pad[3];
+};
+
+/* Completion entry, four per cache line */
+struct pcd_cqe
+{
+    __u64 user_data;
+    __s64 result; //bytes transferred or -errno
+};
+
+struct pcd_ring_params
+{
+    __u32 sq_entries; //in: power of 2, up to PCD_RING_MAX_ENTRIES
+    __u32 cq_entries; //in: power of 2, at least sq_entries. 0: twice sq_entries
+    __u32 flags; //in: PCD_RING_*
+    __u32 resv; //must be 0
+    __u64 sq_off; //out: byte offset of the SQEs in the mapping
+    __u64 cq_off; //out: byte offset of the CQEs
+    __u64 ring_size; //out: bytes to mmap
+};
+
+//*************************Commands*****************************//
+
+/* Release the pages backing [offset,offset+len), the range reads as zeroes afterwards.
+   Same as fallocate(FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE) on a regular file. Needs a writable fd */
+#define PCD_IOC_PUNCH_HOLE _IOW(PCD_IOC_MAGIC,1,struct pcd_range_arg)
+
+/* Copy len bytes of the pcdev open as src_fd to this one without going through user space.
+   Same as copy_file_range() between regular files. Returns bytes copied. Needs a writable fd */
+#define PCD_IOC_COPY_RANGE _IOW(PCD_IOC_MAGIC,2,struct pcd_copy_arg)
+
+/* Run nr reads/writes at explicit offsets (no lseek, file position untouched) in one call, in order.
+   Returns how many descriptors ran, each with its own result. Needs the fd open for the ops used */
+#define PCD_IOC_BATCH _IOW(PCD_IOC_MAGIC,3,struct pcd_batch_arg)
+
+/* Set up a ring pair for this fd, returns the ring fd to mmap. The ring's I/O goes to this fd, with its access rights */
+#define PCD_IOC_RING_SETUP _IOWR(PCD_IOC_MAGIC,4,struct pcd_ring_params)
+/* On the ring fd. Without PCD_RING_SQPOLL: consume the SQ now, returns the SQEs consumed.
+   With it: wake the polling thread (PCD_RING_NEED_WAKEUP set), returns 0 */
+#define PCD_RING_IOC_ENTER _IO(PCD_IOC_MAGIC,5)
+
+/* io_uring passthrough (IORING_OP_URING_CMD, cmd_op), payload in the SQE command area.
+   Kernel 6.1 or later only (.uring_cmd): on older kernels (the 5.10 board) io_uring fails the SQE with
+   -EOPNOTSUPP, use PCD_IOC_BATCH or a ring (PCD_IOC_RING_SETUP) there */
+/* PCD_IOC_BATCH, result: descriptors run. May be fewer than nr when one would have waited for a lock:
+   the rest was not run, resubmit from there (-EAGAIN only when none ran, io_uring then retries it blocking) */
+#define PCD_URING_CMD_BATCH _IOW(PCD_IOC_MAGIC,0x80,struct pcd_batch_arg)
+#define PCD_URING_CMD_RESIZE _IOW(PCD_IOC_MAGIC,0x81,struct pcd_resize_arg) //as writing max_size. Needs CAP_SYS_ADMIN
+#define PCD_URING_CMD_STATS _IOW(PCD_IOC_MAGIC,0x82,struct pcd_stats_arg)
+
+#endif //PCD_IOCTL_H
@@ -0,0 +1,340 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_trace.h"
+
+/*
+ * Log mode of a pcdev: a broadcast append log.
+ * Each write() appends one record, every open file reads every record on its own: the file position is
+ * the reader's cursor, the sequence number of the next record it reads (like /dev/kmsg). A read returns
+ * one whole record and moves the cursor to the next one, pread() reads the record of that number,
+ * lseek() moves the cursor by record (SEEK_SET/CUR/END, SEEK_DATA: oldest record still there).
+ * The device buffer is cut into msg_size slots, record n sits in slot n % slots: the log keeps the last
+ * "slots" records. A writer reserves its sequence number (so its slot) with one atomic add, copies, and
+ * publishes the slot by storing the number (release). Writers never wait for readers, they only overwrite.
+ * A reader whose record got overwritten gets -EPIPE, before or while copying it (the slot number changed:
+ * writers mark it busy before touching the data, seqlock style), the cursor stays for the reader to
+ * move (SEEK_DATA or SEEK_END).
+ * The writer of record n + slots waits for the writer of record n to publish, a slot has one writer at a time.
+ * That wait is uninterruptible (the number can't be handed back) but short: a writer faults its source in
+ * before taking a number and copies with page faults off, so between busy and publish it never waits for
+ * user memory (userfaultfd, FUSE, a pcdev hole), only for a backing page allocation.
+ */
+
+//*************************Pre-processor macros*****************************//
+#define PCD_LOG_BUSY S64_MIN //slot seq while a writer fills it
+#define PCD_LOG_DEAD U32_MAX //slot len of a record whose write failed, readers skip it
+#define PCD_LOG_MAX_SLOTS (1UL << 20)
+
+//************************* FUNCTIONS *****************************//
+
+void pcd_log_init(struct pcd_log *log)
+{
+    log->slots = NULL;
+    log->mask = 0;
+    atomic64_set(&log->head,0);
+    init_waitqueue_head(&log->rd_wq);
+    init_waitqueue_head(&log->wr_wq);
+}
+
+/* The reader wakeup condition reads the slots without buf_sem, under RCU: wait for it before freeing. Caller holds buf_sem exclusive */
+static void pcd_log_free_slots(struct pcd_log *log)
+{
+    struct pcd_log_slot *slots = log->slots;
+
+    if (!slots)
+        return;
+    WRITE_ONCE(log->slots,NULL);
+    synchronize_rcu();
+    kvfree(slots);
+}
+
+/*
+ * Cut the device into msg_size slots, empty log starting at record 0. Caller holds buf_sem exclusive
+ * (or probes). -EINVAL when the device doesn't hold a single record
+ */
+int pcd_log_setup(struct pcdev_private_data *dev_data)
+{
+    struct pcd_log *log = &dev_data->log;
+    u32 slot_size = READ_ONCE(dev_data->msg_size);
+    struct pcd_log_slot *slots;
+    unsigned long i, nr;
+
+    nr = min_t(u64,div_u64(pcd_dev_size(dev_data),slot_size),PCD_LOG_MAX_SLOTS);
+    if (!nr)
+        return -EINVAL;
+    nr = rounddown_pow_of_two(nr);
+    slots = kvcalloc(nr,sizeof(*slots),GFP_KERNEL);
+    if (!slots)
+        return -ENOMEM;
+    for (i = 0; i < nr; i++)
+        atomic64_set(&slots[i].seq,(s64)i - (s64)nr); //published "lap -1": record i's writer goes right ahead
+
+    pcd_log_free_slots(log); //log mode again: a new, empty log
+    log->mask = nr - 1;
+    log->slot_size = slot_size;
+    atomic64_set(&log->head,0);
+    smp_store_release(&log->slots,slots); //after the mask, for the reader wakeup condition
+    return PCD_DRV_SUCCESS;
+}
+
+/* Leaving log mode (or unbind): drop the log, sleepers find out the mode changed */
+void pcd_log_teardown(struct pcdev_private_data *dev_data)
+{
+    struct pcd_log *log = &dev_data->log;
+
+    pcd_log_free_slots(log);
+    wake_up_interruptible_all(&log->rd_wq);
+    wake_up_all(&log->wr_wq);
+}
+
+/* Sequence number of the oldest record still in the log (or about to be written over) */
+static s64 pcd_log_oldest(struct pcd_log *log)
+{
+    return max_t(s64,0,atomic64_read(&log->head) - (s64)(READ_ONCE(log->mask) + 1));
+}
+
+/* Where a new reader starts: the oldest record there is */
+loff_t pcd_log_open_pos(struct pcdev_private_data *pcdev_data)
+{
+    return pcd_log_oldest(&pcdev_data->log);
+}
+
+/*
+ * Reader wakeup condition, the slot test of pcd_log_peek without buf_sem: record cursor (or a later lap)
+ * is published, or cursor was overrun. Only reserved doesn't count, the reader would spin on it
+ */
+static bool pcd_log_readable(struct pcdev_private_data *pcdev_data, s64 cursor)
+{
+    struct pcd_log *log = &pcdev_data->log;
+    struct pcd_log_slot *slots;
+    s64 laps;
+    bool ret = true;
+
+    if (pcd_dev_left_mode(pcdev_data,PCD_MODE_LOG))
+        return true;
+    rcu_read_lock();
+    slots = smp_load_acquire(&log->slots);
+    if (slots)
+    {
+        laps = (s64)READ_ONCE(log->mask) + 1;
+        ret = (atomic64_read(&slots[cursor & (laps - 1)].seq) >= cursor) || //busy is S64_MIN
+              (atomic64_read(&log->head) - cursor > laps);
+    }
+    rcu_read_unlock();
+    return ret;
+}
+
+/* Take buf_sem shared and check the device is (still) there and in log mode */
+static int pcd_log_lock(struct pcdev_private_data *pcdev_data, bool nonblock)
+{
+    if (nonblock)
+    {
+        if (!down_read_trylock(&pcdev_data->buf_sem))
+            return -EAGAIN;
+    }
+    else
+        down_read(&pcdev_data->buf_sem);
+    if (pcdev_data->dead)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -ENODEV;
+    }
+    if (pcdev_data->pdata.mode != PCD_MODE_LOG)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -EIO; //mode switched under us, the log is gone
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+/*
+ * State of record cursor: its length when readable, -EAGAIN not written yet, -EPIPE overwritten,
+ * -ENODATA a failed append readers skip. Caller holds buf_sem shared
+ */
+static long pcd_log_peek(struct pcd_log *log, s64 cursor)
+{
+    struct pcd_log_slot *slot = &log->slots[cursor & log->mask];
+    s64 seq;
+    u32 len;
+
+    /* a later lap was reserved: its writer may be overwriting the slot already */
+    if (atomic64_read(&log->head) - cursor > (s64)log->mask + 1)
+        return -EPIPE;
+    seq = atomic64_read_acquire(&slot->seq); //pairs with the writer's release: len and data are there
+    if (seq == cursor)
+    {
+        len = READ_ONCE(slot->len);
+        return (len == PCD_LOG_DEAD) ? -ENODATA : len;
+    }
+    if ((seq != PCD_LOG_BUSY) && (seq > cursor))
+        return -EPIPE;
+    return -EAGAIN; //previous lap still in the slot, or our record is being written
+}
+
+ssize_t pcd_log_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    struct pcd_log *log = &pcdev_data->log;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(to);
+    s64 cursor = iocb->ki_pos;
+    ssize_t ret;
+    size_t copied;
+
+    if (cursor < 0)
+        return -EINVAL;
+    for(;;)
+    {
+        ret = pcd_log_lock(pcdev_data,nonblock);
+        if (ret)
+            goto out;
+        ret = pcd_log_peek(log,cursor);
+        if (ret == -ENODATA)
+        {
+            up_read(&pcdev_data->buf_sem);
+            cursor++; //a failed append, nothing to deliver
+            continue;
+        }
+        if (ret != -EAGAIN)
+            break;
+        up_read(&pcdev_data->buf_sem);
+        if (nonblock)
+            goto out;
+        ret = wait_event_interruptible(log->rd_wq,pcd_log_readable(pcdev_data,cursor));
+        if (ret)
+            goto out;
+    }
+    if (ret < 0)
+        goto unlock; //-EPIPE
+    if ((size_t)ret > count)
+    {
+        ret = -EMSGSIZE; //cursor stays, retry with a larger buffer
+        goto unlock;
+    }
+
+    copied = pcd_backing_to_iter(&pcdev_data->backing,(loff_t)(cursor & log->mask) * log->slot_size,ret,to);
+    smp_rmb(); //data before the recheck, pairs with the writer's barrier between busy and data
+    if (atomic64_read(&log->slots[cursor & log->mask].seq) != cursor)
+        ret = -EPIPE; //overwritten while we copied, what the reader got is torn
+    else if (copied < (size_t)ret)
+        ret = -EFAULT;
+    else
+        iocb->ki_pos = cursor + 1;
+unlock:
+    up_read(&pcdev_data->buf_sem);
+out:
+    trace_pcd_read(MINOR(pcdev_data->dev_num),cursor,count,ret);
+    pcd_stats_rw(pcdev_data,false,count,ret);
+    return ret;
+}
+
+ssize_t pcd_log_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    struct pcd_log *log = &pcdev_data->log;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(from);
+    struct pcd_log_slot *slot;
+    s64 seq = 0;
+    ssize_t ret;
+
+    ret = pcd_log_lock(pcdev_data,nonblock);
+    if (ret)
+        goto out;
+    if (count > log->slot_size)
+    {
+        ret = -EMSGSIZE; //a record is never split
+        goto unlock;
+    }
+
+    for(;;)
+    {
+        /* no number taken yet: a bad buffer fails the write with nothing appended */
+        if (count && !pcd_fault_in_readable(from,count))
+        {
+            ret = -EFAULT;
+            goto unlock;
+        }
+        /* the one atomic op of an append: sequence number and slot */
+        seq = atomic64_fetch_add(1,&log->head);
+        slot = &log->slots[seq & log->mask];
+        /* only behind a writer of the previous lap that is still copying (never long, see above), never behind readers */
+        wait_event(log->wr_wq,atomic64_read_acquire(&slot->seq) == seq - (s64)(log->mask + 1));
+        atomic64_set(&slot->seq,PCD_LOG_BUSY);
+        smp_wmb(); //readers still copying the old record see busy before any new byte
+
+        pagefault_disable();
+        ret = count ? pcd_backing_from_iter(&pcdev_data->backing,(loff_t)(seq & log->mask) * log->slot_size,count,from,false) : 0;
+        pagefault_enable();
+        if (ret == -EFAULT)
+            ret = 0; //shmem: the source went away again
+        /* short: the source was reclaimed since it was faulted in. This number becomes a dead record, go again with the next one */
+        slot->len = ((ret < 0) || ((size_t)ret < count)) ? PCD_LOG_DEAD : ret;
+        atomic64_set_release(&slot->seq,seq); //publish
+        if (wq_has_sleeper(&log->wr_wq))
+            wake_up_all(&log->wr_wq);
+        if (wq_has_sleeper(&log->rd_wq))
+            wake_up_interruptible_poll(&log->rd_wq,EPOLLIN|EPOLLRDNORM);
+        if ((ret < 0) || ((size_t)ret == count))
+            break; //appended, or -ENOMEM
+        iov_iter_revert(from,ret);
+    }
+unlock:
+    up_read(&pcdev_data->buf_sem);
+out:
+    trace_pcd_write(MINOR(pcdev_data->dev_num),seq,count,ret);
+    pcd_stats_rw(pcdev_data,true,count,ret);
+    return ret;
+}
+
+/* Seek by record: SEEK_SET/CUR/END in sequence numbers, SEEK_DATA to the oldest record still there */
+loff_t pcd_log_lseek(struct file *filep, loff_t offset, int whence)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    struct pcd_log *log = &pcdev_data->log;
+    s64 head = atomic64_read(&log->head);
+    loff_t pos;
+
+    switch(whence)
+    {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            if (check_add_overflow(filep->f_pos,offset,&pos))
+                return -EINVAL;
+            break;
+        case SEEK_END:
+            if (check_add_overflow((loff_t)head,offset,&pos))
+                return -EINVAL;
+            break;
+        case SEEK_DATA:
+            pos = pcd_log_oldest(log);
+            break;
+        default:
+            return -EINVAL;
+    }
+    /* up to the next record to be written, older ones may be gone already (the read says -EPIPE) */
+    if ((pos < 0) || (pos > head))
+        return -EINVAL;
+    filep->f_pos = pos;
+    return pos;
+}
+
+__poll_t pcd_log_poll(struct file *filep, poll_table *wait)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM; //appends never wait for readers
+    long ret;
+
+    poll_wait(filep,&pcdev_data->log.rd_wq,wait);
+
+    if (pcd_log_lock(pcdev_data,false))
+        return EPOLLERR;
+    ret = pcd_log_peek(&pcdev_data->log,READ_ONCE(filep->f_pos));
+    up_read(&pcdev_data->buf_sem);
+    if (ret == -EPIPE)
+        mask |= EPOLLERR | EPOLLPRI; //overrun, like /dev/kmsg
+    else if (ret != -EAGAIN) //a failed append too: the read skips it
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
@@ -0,0 +1,348 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_trace.h"
+
+/*
+ * Message mode of a pcdev: a work queue of records.
+ * Each write() enqueues one record, each read() dequeues one whole record (-EMSGSIZE, record left
+ * queued, when the buffer is too small, like mq_receive). Any number of producers and consumers.
+ * The device buffer is cut into slots of msg_size bytes, one record each, used as a bounded MPMC queue
+ * (Vyukov): every slot has a sequence number telling whether it's the turn of the producer or of the
+ * consumer of position pos. A side claims a position with one cmpxchg and owns the slot from then on,
+ * copies without any lock, and hands the slot over by storing the next sequence number (release).
+ * So producers and consumers never wait for each other unless the queue is full or empty.
+ * A write that fails after claiming its slot (no memory) still has to hand it over: the record is
+ * marked dead and consumers skip it. The source is faulted in before a slot is claimed and copied with
+ * page faults disabled, if it was reclaimed in between the slot goes dead and the write claims another.
+ * A zero length write queues nothing, an empty record would read as end of file.
+ */
+
+//*************************Pre-processor macros*****************************//
+#define PCD_MSG_DEAD U32_MAX //slot len of a record whose write failed
+#define PCD_MSG_MAX_SLOTS (1UL << 20)
+
+//************************* FUNCTIONS *****************************//
+
+void pcd_msg_init(struct pcd_msgq *q)
+{
+    q->slots = NULL;
+    atomic_long_set(&q->enq_pos,0);
+    atomic_long_set(&q->deq_pos,0);
+    init_waitqueue_head(&q->rd_wq);
+    init_waitqueue_head(&q->wr_wq);
+}
+
+/* Wakeup conditions read the slots without buf_sem, under RCU: wait for them before freeing. Caller holds buf_sem exclusive */
+static void pcd_msg_free_slots(struct pcd_msgq *q)
+{
+    struct pcd_msg_slot *slots = q->slots;
+
+    if (!slots)
+        return;
+    WRITE_ONCE(q->slots,NULL);
+    synchronize_rcu();
+    kvfree(slots);
+}
+
+/*
+ * Cut the device into msg_size slots, empty queue. Caller holds buf_sem exclusive (or probes).
+ * -EINVAL when the device doesn't hold a single record
+ */
+int pcd_msg_setup(struct pcdev_private_data *dev_data)
+{
+    struct pcd_msgq *q = &dev_data->msgq;
+    u32 slot_size = READ_ONCE(dev_data->msg_size);
+    struct pcd_msg_slot *slots;
+    unsigned long i, nr;
+
+    nr = min_t(u64,div_u64(pcd_dev_size(dev_data),slot_size),PCD_MSG_MAX_SLOTS);
+    if (!nr)
+        return -EINVAL;
+    nr = rounddown_pow_of_two(nr); //positions map to slots with a mask
+    slots = kvcalloc(nr,sizeof(*slots),GFP_KERNEL);
+    if (!slots)
+        return -ENOMEM;
+    for (i = 0; i < nr; i++)
+        atomic_long_set(&slots[i].seq,i); //producer's turn for position i
+
+    pcd_msg_free_slots(q); //message mode again: a new, empty queue
+    q->mask = nr - 1;
+    q->slot_size = slot_size;
+    atomic_long_set(&q->enq_pos,0);
+    atomic_long_set(&q->deq_pos,0);
+    smp_store_release(&q->slots,slots); //after the mask, for the wakeup conditions
+    return PCD_DRV_SUCCESS;
+}
+
+/* Leaving message mode (or unbind): drop the queue, sleepers find out the mode changed */
+void pcd_msg_teardown(struct pcdev_private_data *dev_data)
+{
+    struct pcd_msgq *q = &dev_data->msgq;
+
+    pcd_msg_free_slots(q);
+    wake_up_interruptible_all(&q->rd_wq);
+    wake_up_interruptible_all(&q->wr_wq);
+}
+
+/*
+ * Is it turn's side's turn at *ppos: the slot test of pcd_msg_poll, without buf_sem. A position only
+ * claimed, not yet handed over, doesn't count (the sleeper would spin on it). No slots: the mode changed
+ */
+static bool pcd_msg_turn(struct pcd_msgq *q, atomic_long_t *ppos, long turn)
+{
+    struct pcd_msg_slot *slots;
+    long pos = atomic_long_read(ppos);
+    bool ret = true;
+
+    rcu_read_lock();
+    slots = smp_load_acquire(&q->slots);
+    if (slots)
+        ret = (atomic_long_read_acquire(&slots[pos & READ_ONCE(q->mask)].seq) == pos + turn);
+    rcu_read_unlock();
+    return ret;
+}
+
+/* Wakeup conditions: the oldest record is published, the next slot is handed back */
+static bool pcd_msg_readable(struct pcdev_private_data *pcdev_data)
+{
+    return pcd_dev_left_mode(pcdev_data,PCD_MODE_MSG) || pcd_msg_turn(&pcdev_data->msgq,&pcdev_data->msgq.deq_pos,1);
+}
+
+static bool pcd_msg_writable(struct pcdev_private_data *pcdev_data)
+{
+    return pcd_dev_left_mode(pcdev_data,PCD_MODE_MSG) || pcd_msg_turn(&pcdev_data->msgq,&pcdev_data->msgq.enq_pos,0);
+}
+
+/* Claim a free slot for a producer. -EAGAIN when full. Caller holds buf_sem shared */
+static int pcd_msg_reserve(struct pcd_msgq *q, long *ppos)
+{
+    long pos = atomic_long_read(&q->enq_pos);
+    long diff;
+
+    for (;;)
+    {
+        diff = atomic_long_read_acquire(&q->slots[pos & q->mask].seq) - pos;
+        if (!diff)
+        {
+            if (atomic_long_try_cmpxchg(&q->enq_pos,&pos,pos + 1))
+            {
+                *ppos = pos;
+                return PCD_DRV_SUCCESS;
+            }
+            continue; //another producer took it, pos is the current one now
+        }
+        if (diff < 0)
+            return -EAGAIN; //slot still holds the record of the previous lap
+        pos = atomic_long_read(&q->enq_pos);
+    }
+}
+
+/* Hand a written slot to the consumers */
+static void pcd_msg_publish(struct pcd_msgq *q, long pos, u32 len)
+{
+    struct pcd_msg_slot *slot = &q->slots[pos & q->mask];
+
+    slot->len = len;
+    atomic_long_set_release(&slot->seq,pos + 1); //record contents and len before the turn
+    if (wq_has_sleeper(&q->rd_wq))
+        wake_up_interruptible_poll(&q->rd_wq,EPOLLIN|EPOLLRDNORM);
+}
+
+/* Hand a read slot back to the producers of the next lap */
+static void pcd_msg_free(struct pcd_msgq *q, long pos)
+{
+    atomic_long_set_release(&q->slots[pos & q->mask].seq,pos + q->mask + 1);
+    if (wq_has_sleeper(&q->wr_wq))
+        wake_up_interruptible_poll(&q->wr_wq,EPOLLOUT|EPOLLWRNORM);
+}
+
+/*
+ * Claim the oldest published record for a consumer, dead ones are skipped. Returns its length,
+ * -EAGAIN when empty, -EMSGSIZE (nothing claimed) when it's longer than count. Caller holds buf_sem shared
+ */
+static long pcd_msg_take(struct pcd_msgq *q, size_t count, long *ppos)
+{
+    long pos = atomic_long_read(&q->deq_pos);
+    struct pcd_msg_slot *slot;
+    long diff;
+    u32 len;
+
+    for (;;)
+    {
+        slot = &q->slots[pos & q->mask];
+        diff = atomic_long_read_acquire(&slot->seq) - (pos + 1);
+        if (diff < 0)
+            return -EAGAIN; //not published yet
+        if (diff > 0)
+        {
+            pos = atomic_long_read(&q->deq_pos); //already taken by another consumer
+            continue;
+        }
+        len = READ_ONCE(slot->len); //stable while the slot is the consumers' turn
+        if ((len != PCD_MSG_DEAD) && (len > count))
+            return -EMSGSIZE;
+        if (!atomic_long_try_cmpxchg(&q->deq_pos,&pos,pos + 1))
+            continue;
+        if (len != PCD_MSG_DEAD)
+        {
+            *ppos = pos;
+            return len;
+        }
+        pcd_msg_free(q,pos);
+        pos++;
+    }
+}
+
+/* Take buf_sem shared and check the device is (still) there and in message mode */
+static int pcd_msg_lock(struct pcdev_private_data *pcdev_data, bool nonblock)
+{
+    if (nonblock)
+    {
+        if (!down_read_trylock(&pcdev_data->buf_sem))
+            return -EAGAIN;
+    }
+    else
+        down_read(&pcdev_data->buf_sem);
+    if (pcdev_data->dead)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -ENODEV;
+    }
+    if (pcdev_data->pdata.mode != PCD_MODE_MSG)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -EIO; //mode switched under us, the queue is gone
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+ssize_t pcd_msg_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    struct pcd_msgq *q = &pcdev_data->msgq;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(to);
+    long pos = 0;
+    ssize_t ret;
+    size_t copied;
+
+    /* wait for a record. buf_sem is only held while the queue is touched, never while sleeping */
+    for(;;)
+    {
+        ret = pcd_msg_lock(pcdev_data,nonblock);
+        if (ret)
+            goto out;
+        ret = pcd_msg_take(q,count,&pos);
+        if (ret != -EAGAIN)
+            break;
+        up_read(&pcdev_data->buf_sem);
+        if (nonblock)
+            goto out;
+        ret = wait_event_interruptible(q->rd_wq,pcd_msg_readable(pcdev_data));
+        if (ret)
+            goto out;
+    }
+    if (ret < 0)
+        goto unlock; //-EMSGSIZE
+
+    /* ours now, copied without holding anyone up */
+    copied = pcd_backing_to_iter(&pcdev_data->backing,(loff_t)(pos & q->mask) * q->slot_size,ret,to);
+    pcd_msg_free(q,pos);
+    if (copied < (size_t)ret)
+        ret = -EFAULT; //the record is gone, like a datagram read into a bad buffer
+unlock:
+    up_read(&pcdev_data->buf_sem);
+out:
+    trace_pcd_read(MINOR(pcdev_data->dev_num),pos,count,ret);
+    pcd_stats_rw(pcdev_data,false,count,ret);
+    return ret;
+}
+
+ssize_t pcd_msg_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    struct pcd_msgq *q = &pcdev_data->msgq;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = iov_iter_count(from);
+    long pos = 0;
+    ssize_t ret;
+
+    if (!count)
+    {
+        ret = 0; //a zero length record would read as end of file
+        goto out;
+    }
+
+    for(;;)
+    {
+        /* no slot taken yet: a bad buffer fails the write with nothing queued */
+        if (!pcd_fault_in_readable(from,count))
+        {
+            ret = -EFAULT;
+            goto out;
+        }
+
+        /* wait for a free slot */
+        for(;;)
+        {
+            ret = pcd_msg_lock(pcdev_data,nonblock);
+            if (ret)
+                goto out;
+            if (count > q->slot_size)
+            {
+                ret = -EMSGSIZE; //a record is never split
+                goto unlock;
+            }
+            ret = pcd_msg_reserve(q,&pos);
+            if (!ret)
+                break;
+            up_read(&pcdev_data->buf_sem);
+            if (nonblock)
+                goto out;
+            ret = wait_event_interruptible(q->wr_wq,pcd_msg_writable(pcdev_data));
+            if (ret)
+                goto out;
+        }
+
+        /* readers wait on this slot, never on our page faults */
+        pagefault_disable();
+        ret = pcd_backing_from_iter(&pcdev_data->backing,(loff_t)(pos & q->mask) * q->slot_size,count,from,false);
+        pagefault_enable();
+        if (ret == -EFAULT)
+            ret = 0; //shmem: the source went away again
+        /* short: the source was reclaimed since it was faulted in. This slot becomes a dead record, go again with the next one */
+        pcd_msg_publish(q,pos,((ret < 0) || ((size_t)ret < count)) ? PCD_MSG_DEAD : ret);
+        if ((ret < 0) || ((size_t)ret == count))
+            break; //queued, or -ENOMEM
+        up_read(&pcdev_data->buf_sem);
+        iov_iter_revert(from,ret);
+    }
+unlock:
+    up_read(&pcdev_data->buf_sem);
+out:
+    trace_pcd_write(MINOR(pcdev_data->dev_num),pos,count,ret);
+    pcd_stats_rw(pcdev_data,true,count,ret);
+    return ret;
+}
+
+__poll_t pcd_msg_poll(struct file *filep, poll_table *wait)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    struct pcd_msgq *q = &pcdev_data->msgq;
+    __poll_t mask = 0;
+    long pos;
+
+    poll_wait(filep,&q->rd_wq,wait);
+    poll_wait(filep,&q->wr_wq,wait);
+
+    /* exact answer from the slots: a claimed but not yet published record isn't readable */
+    if (pcd_msg_lock(pcdev_data,false))
+        return EPOLLERR;
+    pos = atomic_long_read(&q->deq_pos);
+    if (atomic_long_read_acquire(&q->slots[pos & q->mask].seq) == pos + 1)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    pos = atomic_long_read(&q->enq_pos);
+    if (atomic_long_read_acquire(&q->slots[pos & q->mask].seq) == pos)
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    up_read(&pcdev_data->buf_sem);
+    return mask;
+}
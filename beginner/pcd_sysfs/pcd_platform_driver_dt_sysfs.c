@@ -13,7 +13,8 @@ struct device_config pcdev_cfg[] =
     [PCDEVA1X] = {.config_item1 = 60, .config_item2 = 21},
     [PCDEVB1X] = {.config_item1 = 50, .config_item2 = 22},
     [PCDEVC1X] = {.config_item1 = 40, .config_item2 = 23},
-    [PCDEVD1X] = {.config_item1 = 30, .config_item2 = 24}
+    [PCDEVD1X] = {.config_item1 = 30, .config_item2 = 24},
+    [PCDEVCFS] = {.config_item1 = 0, .config_item2 = 0}
 };
 
 //this array is null terminated
@@ -23,6 +24,7 @@ struct platform_device_id pcdev_ids[] =
     {.name = "pcdev-B1x",.driver_data = PCDEVB1X},
     {.name = "pcdev-C1x",.driver_data = PCDEVC1X},
     {.name = "pcdev-D1x",.driver_data = PCDEVD1X},
+    {.name = "pcdev-cfs",.driver_data = PCDEVCFS}, //registered by pcd_configfs.c
     {}
 };
 
@@ -42,20 +44,40 @@ struct platform_driver pcd_platform_driver =
     .id_table = pcdev_ids,
     .driver = {
         .name = "pseudo-char-device", //name is don't case if id_table way used.
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS, //devices probe in parallel, nothing in probe depends on probe order
         .of_match_table = of_match_ptr(org_pcdev_dt_match) //device tree support. This macro call ensures assigning null/actual ptr if config_of is disabled/enabled. 
     }
 };
 
 struct pcdrv_private_data pcdrv_data;
 
+/* size of the chrdev region = max number of pcdevs alive at once */
+static unsigned int max_devices = MAX_DEVICES;
+module_param(max_devices,uint,S_IRUGO);
+MODULE_PARM_DESC(max_devices,"Number of minors reserved for pcdevs (default 1024, max 1M)");
+
 
 /* File Ops of driver */
 struct file_operations pcd_fops = 
 {
     .llseek = pcd_lseek,
     .open = pcd_open,
-    .read = pcd_read,
-    .write = pcd_write,
+    .read_iter = pcd_read_iter,
+    .write_iter = pcd_write_iter,
+    .mmap = pcd_mmap,
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 5, 18, 0 ) ) // Hack to support newer kernel versions (host linux is newer currently)
+    .get_unmapped_area = thp_get_unmapped_area, //PMD aligned addresses for large mappings, huge backing maps whole folios
+    #else
+    .get_unmapped_area = pcd_get_unmapped_area, //same, thp_get_unmapped_area only aligns DAX files before 5.18
+    #endif
+    .splice_read = pcd_splice_read, //device pages go into the pipe by reference
+    .splice_write = iter_file_splice_write, //pipe pages handed to write_iter as a bvec, one in kernel copy
+    .poll = pcd_poll,
+    .unlocked_ioctl = pcd_ioctl,
+    .compat_ioctl = compat_ptr_ioctl, //fixed size __u64 args, same layout for 32 bit callers
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 1, 0 ) ) // Hack to support newer kernel versions (host linux is newer currently)
+    .uring_cmd = pcd_uring_cmd, //batch/resize/stats submitted through io_uring
+    #endif
     .release = pcd_release,
     .owner = THIS_MODULE
 };
@@ -63,6 +85,42 @@ struct file_operations pcd_fops =
 /* Create two  variables of struct device_attribute */
 static DEVICE_ATTR(max_size,S_IRUGO|S_IWUSR,show_max_size,store_max_size);
 static DEVICE_ATTR(serial_num,S_IRUGO,show_serial_num,NULL);
+static DEVICE_ATTR(mode,S_IRUGO|S_IWUSR,show_mode,store_mode);
+static DEVICE_ATTR(resident_bytes,S_IRUGO,show_resident_bytes,NULL);
+static DEVICE_ATTR(probe_time_ns,S_IRUGO,show_probe_time_ns,NULL);
+static DEVICE_ATTR(backing,S_IRUGO,show_backing,NULL);
+static DEVICE_ATTR(numa_node,S_IRUGO,show_numa_node,NULL);
+static DEVICE_ATTR(msg_size,S_IRUGO|S_IWUSR,show_msg_size,store_msg_size);
+static DEVICE_ATTR(ring_idle_us,S_IRUGO|S_IWUSR,show_ring_idle_us,store_ring_idle_us);
+
+/* "org,mode" DT property and mode sysfs attribute values, indexed by PCD_MODE_* */
+const char * const pcd_mode_names[PCD_NR_MODES] =
+{
+    [PCD_MODE_ARRAY] = "array",
+    [PCD_MODE_FIFO] = "fifo",
+    [PCD_MODE_MSG] = "message",
+    [PCD_MODE_LOG] = "log"
+};
+
+/* "org,backing" DT property and backing sysfs attribute values, indexed by PCD_BACKING_* */
+const char * const pcd_backing_names[PCD_NR_BACKINGS] =
+{
+    [PCD_BACKING_SPARSE] = "sparse",
+    [PCD_BACKING_PAGES] = "pages",
+    [PCD_BACKING_CONTIG] = "contiguous",
+    [PCD_BACKING_SHMEM] = "shmem",
+    [PCD_BACKING_HUGE] = "huge"
+};
+
+/* "org,size-unit" DT property values. Unit n multiplies org,size by 2^(10*n) */
+static const char * const pcd_size_units[] =
+{
+    "bytes",
+    "KiB",
+    "MiB",
+    "GiB",
+    "TiB"
+};
 
 //************************* FUNCTIONS *****************************//
 
@@ -70,7 +128,7 @@ ssize_t show_max_size(struct device *dev, struct device_attribute *attr, char *b
 {
     /* get access to the device private data */
     struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
-    return sprintf(buf,"%d\n",dev_data->pdata.size);
+    return sprintf(buf,"%lld\n",pcd_dev_size(dev_data));
 }
 
 ssize_t show_serial_num(struct device *dev, struct device_attribute *attr, char *buf)
@@ -80,18 +138,215 @@ ssize_t show_serial_num(struct device *dev, struct device_attribute *attr, char
     return sprintf(buf,"%s\n",dev_data->pdata.serial_number);
 }
 
+/* Resize a live device (max_size attribute, org,size DT update) */
+int pcd_dev_resize(struct pcdev_private_data *dev_data, u64 result)
+{
+    struct pcd_range range;
+    loff_t old_size;
+
+    if((result == 0) || (result > LLONG_MAX))
+        return -EINVAL;
+
+    /*
+     * Online resize, I/O keeps running. Nothing is copied:
+     * grow only publishes the new size (pages come on first write), O(1) whatever the device size.
+     * shrink publishes the new size first, so new ops stay below it, then drops the pages past it under
+     * the writer range lock: writers/faults that sampled the old size either finish before or recheck
+     * the size after. Readers still copying past the new end see zeroes, never freed memory (page refs).
+     */
+    mutex_lock(&dev_data->resize_lock);
+    if(dev_data->dead)
+    {
+        mutex_unlock(&dev_data->resize_lock);
+        return -ENODEV;
+    }
+    /* ring positions and message slots depend on the size, switch the device back to array mode first */
+    if(dev_data->pdata.mode != PCD_MODE_ARRAY)
+    {
+        mutex_unlock(&dev_data->resize_lock);
+        return -EBUSY;
+    }
+    old_size = pcd_dev_size(dev_data);
+    if(result == old_size)
+    {
+        mutex_unlock(&dev_data->resize_lock);
+        return PCD_DRV_SUCCESS;
+    }
+    atomic64_set(&dev_data->size,result);
+    if(result < old_size)
+    {
+        /* like truncate_pagecache: mappings past the new end go before and after the pages are dropped (a fault
+        of a present page may map one in between), faults there are SIGBUS from now on. The last partial page stays */
+        pcd_dev_unmap(dev_data,round_up(result,PAGE_SIZE),0,true);
+        /* killed while waiting: the pages past the end are just dropped later (next shrink or unbind) */
+        if(!pcd_range_lock(&dev_data->wr_ranges,&range,result,old_size,false))
+        {
+            pcd_backing_truncate(&dev_data->backing,result);
+            if(dev_data->replicas)
+                pcd_replicas_truncate(dev_data,result);
+            pcd_dev_unmap(dev_data,round_up(result,PAGE_SIZE),0,true);
+            pcd_range_unlock(&dev_data->wr_ranges,&range);
+        }
+    }
+    mutex_unlock(&dev_data->resize_lock);
+    dev_info(dev_data->device,"Device size changed to %llu bytes\n",result);
+    return PCD_DRV_SUCCESS;
+}
+
 ssize_t store_max_size(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
     /* get access to the device private data */
     struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
-    long result;
+    u64 result;
     int ret;
     
-    if(ret = kstrtol(buf,10,&result))
+    if(ret = kstrtoull(buf,10,&result))
+        return ret;
+    if(ret = pcd_dev_resize(dev_data,result))
+        return ret;
+    return count;
+}
+
+ssize_t show_resident_bytes(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    u64 pages = pcd_backing_resident(&dev_data->backing) + pcd_replicas_resident(dev_data);
+    return sprintf(buf,"%llu\n",pages << PAGE_SHIFT);
+}
+
+ssize_t show_backing(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%s\n",pcd_backing_names[dev_data->pdata.backing]);
+}
+
+ssize_t show_numa_node(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%d\n",dev_data->backing.nid); //-1: no preference
+}
+
+ssize_t show_msg_size(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%u\n",READ_ONCE(dev_data->msg_size));
+}
+
+ssize_t store_msg_size(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    unsigned int result;
+    int ret;
+
+    if(ret = kstrtouint(buf,10,&result))
+        return ret;
+    if((result == 0) || (result > SZ_1M))
+        return -EINVAL;
+    /* the slots of a live queue or log stay as they are, switch to array mode first */
+    mutex_lock(&dev_data->resize_lock);
+    if((dev_data->pdata.mode == PCD_MODE_MSG) || (dev_data->pdata.mode == PCD_MODE_LOG))
+        ret = -EBUSY;
+    else
+        WRITE_ONCE(dev_data->msg_size,result);
+    mutex_unlock(&dev_data->resize_lock);
+    return ret ? ret : count;
+}
+
+ssize_t show_ring_idle_us(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%u\n",READ_ONCE(dev_data->ring_idle_us));
+}
+
+ssize_t store_ring_idle_us(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    unsigned int result;
+    int ret;
+
+    if(ret = kstrtouint(buf,10,&result))
+        return ret;
+    WRITE_ONCE(dev_data->ring_idle_us,result); //from the next idle period of the polling thread
+    return count;
+}
+
+ssize_t show_probe_time_ns(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%llu\n",READ_ONCE(dev_data->probe_ns));
+}
+
+ssize_t show_mode(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%s\n",pcd_mode_names[dev_data->pdata.mode]);
+}
+
+/* Switch the access mode of a live device (mode attribute, org,mode DT update) */
+static int pcd_dev_set_mode(struct pcdev_private_data *dev_data, int mode)
+{
+    int ret = PCD_DRV_SUCCESS;
+    int old;
+
+    /* fifo, message and log writes bypass the replicas, they would be stale when back in array mode */
+    if((mode != PCD_MODE_ARRAY) && dev_data->replicas)
+        return -EINVAL;
+    /* no resize and no read/write in flight while the mode flips. Ring/queue starts empty */
+    mutex_lock(&dev_data->resize_lock);
+    if((mode == PCD_MODE_FIFO) && (pcd_dev_size(dev_data) > LONG_MAX))
+    {
+        mutex_unlock(&dev_data->resize_lock);
+        return -EFBIG; //ring positions are unsigned long
+    }
+    down_write(&dev_data->buf_sem);
+    if(dev_data->dead)
+        ret = -ENODEV;
+    else if(mode == PCD_MODE_MSG)
+        ret = pcd_msg_setup(dev_data); //-EINVAL: smaller than msg_size
+    else if(mode == PCD_MODE_LOG)
+        ret = pcd_log_setup(dev_data);
+    if(!ret)
+    {
+        old = dev_data->pdata.mode;
+        dev_data->pdata.mode = mode; //before the teardown wakes the sleepers, they go on the mode
+        if((old == PCD_MODE_MSG) && (mode != PCD_MODE_MSG))
+            pcd_msg_teardown(dev_data);
+        if((old == PCD_MODE_LOG) && (mode != PCD_MODE_LOG))
+            pcd_log_teardown(dev_data);
+        pcd_fifo_reset(&dev_data->fifo);
+        /* array mappings would alias the ring or queue storage: zapped, faults outside array mode are SIGBUS */
+        if((old == PCD_MODE_ARRAY) && (mode != PCD_MODE_ARRAY))
+            pcd_dev_unmap(dev_data,0,0,true);
+    }
+    up_write(&dev_data->buf_sem);
+    mutex_unlock(&dev_data->resize_lock);
+    if(ret)
+        return ret;
+    dev_info(dev_data->device,"Device mode changed to %s\n",pcd_mode_names[mode]);
+    return PCD_DRV_SUCCESS;
+}
+
+ssize_t store_mode(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    int mode;
+    int ret;
+
+    mode = sysfs_match_string(pcd_mode_names,buf);
+    if(mode < 0)
+        return mode;
+    if(ret = pcd_dev_set_mode(dev_data,mode))
         return ret;
-    dev_data->pdata.size = result;
-    dev_data->buffer = krealloc(dev_data->buffer,dev_data->pdata.size,GFP_KERNEL);
-    dev_info(dev,"Re-allocated memory for the device %d\n",result);
     return count;
 }
 
@@ -102,14 +357,68 @@ static int pcd_sysfs_create_files(struct device *pcd_dev)
     {
         return ret;
     }
+    if(ret = sysfs_create_file(&pcd_dev->kobj,&dev_attr_mode.attr))
+    {
+        return ret;
+    }
+    if(ret = sysfs_create_file(&pcd_dev->kobj,&dev_attr_resident_bytes.attr))
+    {
+        return ret;
+    }
+    if(ret = sysfs_create_file(&pcd_dev->kobj,&dev_attr_probe_time_ns.attr))
+    {
+        return ret;
+    }
+    if(ret = sysfs_create_file(&pcd_dev->kobj,&dev_attr_backing.attr))
+    {
+        return ret;
+    }
+    if(ret = sysfs_create_file(&pcd_dev->kobj,&dev_attr_numa_node.attr))
+    {
+        return ret;
+    }
+    if(ret = sysfs_create_file(&pcd_dev->kobj,&dev_attr_msg_size.attr))
+    {
+        return ret;
+    }
+    if(ret = sysfs_create_file(&pcd_dev->kobj,&dev_attr_ring_idle_us.attr))
+    {
+        return ret;
+    }
+    if(ret = sysfs_create_group(&pcd_dev->kobj,&pcd_stats_group))
+    {
+        return ret;
+    }
     return sysfs_create_file(&pcd_dev->kobj,&dev_attr_serial_num.attr);
 }
 
 /* local helper function to get platform data */
+/* org,size (one cell, or two for devices past 4GB) scaled by org,size-unit (NULL: bytes) */
+static int pcdev_dt_size(const struct property *size_prop, const char *unit, u64 *size)
+{
+    int shift;
+
+    if(!size_prop || !size_prop->value ||
+       ((size_prop->length != sizeof(u32)) && (size_prop->length != sizeof(u64))))
+        return -EINVAL;
+    *size = of_read_number(size_prop->value,size_prop->length / sizeof(u32));
+    if(unit){
+        shift = match_string(pcd_size_units,ARRAY_SIZE(pcd_size_units),unit);
+        if((shift < 0) || check_shl_overflow(*size,10 * shift,size))
+            return -EINVAL;
+    }
+    return PCD_DRV_SUCCESS;
+}
+
 static struct pcdev_platform_data* pcdev_get_platdata_from_dt(struct device *dev)
 {
     struct device_node *dev_node = dev->of_node;
     struct pcdev_platform_data *pdata;
+    const char *mode;
+    const char *unit = NULL;
+    const char *backing;
+    struct property *size_prop;
+    u32 node;
 
     if (!dev_node)
     {
@@ -128,17 +437,96 @@ static struct pcdev_platform_data* pcdev_get_platdata_from_dt(struct device *dev
         dev_info(dev,"Missing serial number property\n");
         return ERR_PTR(-EINVAL);
     }
-    if(of_property_read_u32(dev_node,"org,size",&pdata->size)){
+    /* org,size is one cell (u32) or two cells (/bits/ 64 or <hi lo>) for devices past 4GB */
+    size_prop = of_find_property(dev_node,"org,size",NULL);
+    if(!size_prop){
         dev_info(dev,"Missing size property\n");
         return ERR_PTR(-EINVAL);
     }
+    /* optional. org,size is in bytes when absent */
+    of_property_read_string(dev_node,"org,size-unit",&unit);
+    if(pcdev_dt_size(size_prop,unit,&pdata->size)){
+        dev_info(dev,"Invalid size property (unit %s)\n",unit ? unit : "bytes");
+        return ERR_PTR(-EINVAL);
+    }
     if(of_property_read_u32(dev_node,"org,perm",&pdata-> perm)){
         dev_info(dev,"Missing permission property\n");
         return ERR_PTR(-EINVAL);
     }
+    /* optional. array mode when absent */
+    pdata->mode = PCD_MODE_ARRAY;
+    if(!of_property_read_string(dev_node,"org,mode",&mode)){
+        pdata->mode = match_string(pcd_mode_names,ARRAY_SIZE(pcd_mode_names),mode);
+        if(pdata->mode < 0){
+            dev_info(dev,"Invalid mode property %s\n",mode);
+            return ERR_PTR(-EINVAL);
+        }
+    }
+    /* optional performance properties (overlays/pcdev_binding.txt). Sparse, any node, no prefault when absent */
+    pdata->backing = PCD_BACKING_SPARSE;
+    if(!of_property_read_string(dev_node,"org,backing",&backing)){
+        pdata->backing = match_string(pcd_backing_names,ARRAY_SIZE(pcd_backing_names),backing);
+        if(pdata->backing < 0){
+            dev_info(dev,"Invalid backing property %s\n",backing);
+            return ERR_PTR(-EINVAL);
+        }
+    }
+    pdata->numa_node = NUMA_NO_NODE;
+    if(!of_property_read_u32(dev_node,"org,numa-node",&node)){
+        pdata->numa_node = node; //checked against the online nodes in probe
+    }
+    pdata->prefault = of_property_read_bool(dev_node,"org,prefault");
+    pdata->replicas = of_property_read_bool(dev_node,"org,replicas");
     return pdata;
 }
 
+/* Last ref gone (remove, then the last file, mapping and ring): nothing can reach the device anymore */
+static void pcd_dev_release(struct kref *ref)
+{
+    struct pcdev_private_data *dev_data = container_of(ref,struct pcdev_private_data,ref);
+    pcd_msg_teardown(dev_data);
+    pcd_log_teardown(dev_data);
+    pcd_replicas_free(dev_data);
+    pcd_backing_free(&dev_data->backing);
+    pcd_lat_free(dev_data);
+    pcd_stats_free(dev_data);
+    if(!IS_ERR_OR_NULL(dev_data->inode))
+        iput(dev_data->inode);
+    kfree(dev_data);
+}
+
+void pcd_dev_put(struct pcdev_private_data *dev_data)
+{
+    kref_put(&dev_data->ref,pcd_dev_release);
+}
+
+/* Zap the user mappings of [start,start+len) (len 0: to the end), the next access faults again. even_cows: private copies too */
+void pcd_dev_unmap(struct pcdev_private_data *dev_data, loff_t start, loff_t len, bool even_cows)
+{
+    unmap_mapping_range(dev_data->inode->i_mapping,start,len,even_cows);
+}
+
+/*
+ * Unbind with the device still open: the data stays (refs) but every op now fails with -ENODEV.
+ * Under resize_lock and buf_sem exclusive, so no op is half way through, then the sleepers are woken
+ * to find out and the mappings are zapped (faults fail from now on).
+ */
+static void pcd_dev_kill(struct pcdev_private_data *dev_data)
+{
+    mutex_lock(&dev_data->resize_lock);
+    down_write(&dev_data->buf_sem);
+    WRITE_ONCE(dev_data->dead,true);
+    up_write(&dev_data->buf_sem);
+    mutex_unlock(&dev_data->resize_lock);
+    wake_up_interruptible_all(&dev_data->fifo.rd_wq);
+    wake_up_interruptible_all(&dev_data->fifo.wr_wq);
+    wake_up_interruptible_all(&dev_data->msgq.rd_wq);
+    wake_up_interruptible_all(&dev_data->msgq.wr_wq);
+    wake_up_interruptible_all(&dev_data->log.rd_wq);
+    wake_up_all(&dev_data->log.wr_wq);
+    pcd_dev_unmap(dev_data,0,0,true);
+}
+
 int pcd_platform_driver_probe(struct platform_device *pdev)
 {
     struct pcdev_private_data *dev_data;
@@ -147,8 +535,12 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     int driver_data;
     const struct of_device_id* match; 
     struct device *dev = &pdev->dev;
+    u32 minor;
+    int nid;
+    bool populate;
+    u64 t0 = ktime_get_ns();
 
-    dev_info(dev,"A device is detected\n");
+    dev_dbg(dev,"A device is detected\n");
 
     /* 1. Get the platform device data */
     /* Match will be NULL if linux doesn't support CONFIG_OF */
@@ -172,10 +564,40 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
         dev_info(dev,"No platform data available\n");
         return -EINVAL;
     }
+    if ((pdata->mode < 0) || (pdata->mode >= ARRAY_SIZE(pcd_mode_names)))
+    {
+        dev_info(dev,"Invalid device mode %d\n",pdata->mode);
+        return -EINVAL;
+    }
+    if ((pdata->backing < 0) || (pdata->backing >= ARRAY_SIZE(pcd_backing_names)))
+    {
+        dev_info(dev,"Invalid device backing %d\n",pdata->backing);
+        return -EINVAL;
+    }
+    if ((pdata->numa_node != NUMA_NO_NODE) &&
+        ((pdata->numa_node < 0) || (pdata->numa_node >= nr_node_ids) || !node_online(pdata->numa_node)))
+    {
+        dev_info(dev,"NUMA node %d is not online\n",pdata->numa_node);
+        return -EINVAL;
+    }
+    /* replicas serve reads, are copied page by page, and fifo/message writes would bypass them */
+    if (pdata->replicas && (!(pdata->perm & DEV_DRV_PERM_RDONLY) || (pdata->mode != PCD_MODE_ARRAY) ||
+                            (pdata->backing == PCD_BACKING_SHMEM)))
+    {
+        dev_info(dev,"Replicas need a readable array mode device without shmem backing\n");
+        return -EINVAL;
+    }
+    /* loff_t bounds in the file ops, unsigned long ring positions in fifo mode */
+    if ((pdata->size == 0) || (pdata->size > LLONG_MAX) ||
+        ((pdata->mode == PCD_MODE_FIFO) && (pdata->size > LONG_MAX)))
+    {
+        dev_info(dev,"Invalid device size %llu\n",pdata->size);
+        return -EINVAL;
+    }
 
     /* 2. Dynamically allocate memory for the device private data */
-    //dev_data = kzalloc(sizeof(*dev_data),GFP_KERNEL); //can use devm_kmalloc to avoid free. Refer: https://github.com/niekiran/linux-device-driver-1/blob/master/custom_drivers/004_pcd_platform_driver/pcd_platform_driver.c (line 302)
-    dev_data = devm_kzalloc(dev,sizeof(*dev_data),GFP_KERNEL); //devm usage
+    /* not devm: open files, mappings and rings can outlive the unbind, the last ref frees it (pcd_dev_put) */
+    dev_data = kzalloc(sizeof(*dev_data),GFP_KERNEL);
     if(!dev_data)
     {
         dev_info(dev,"Cannot allocate memory\n");
@@ -185,67 +607,141 @@ int pcd_platform_driver_probe(struct platform_device *pdev)
     dev_set_drvdata(&pdev->dev,dev_data);
     dev_data->pdata.serial_number=pdata->serial_number;
     dev_data->pdata.size=pdata->size;
+    atomic64_set(&dev_data->size,pdata->size);
+    mutex_init(&dev_data->resize_lock);
     dev_data->pdata.perm=pdata->perm;
-    dev_info(dev,"Device serial number: %s\n",dev_data->pdata.serial_number);
-    dev_info(dev,"Device size: %d bytes\n",dev_data->pdata.size);
-    dev_info(dev,"Device permission: 0x%x\n",dev_data->pdata.perm);
+    dev_data->pdata.mode=pdata->mode;
+    dev_data->pdata.backing=pdata->backing;
+    dev_data->pdata.numa_node=pdata->numa_node;
+    dev_data->pdata.prefault=pdata->prefault;
+    dev_data->pdata.replicas=pdata->replicas;
+    init_rwsem(&dev_data->buf_sem);
+    pcd_range_lock_init(&dev_data->wr_ranges);
+    pcd_fifo_init(&dev_data->fifo);
+    pcd_msg_init(&dev_data->msgq);
+    pcd_log_init(&dev_data->log);
+    dev_data->msg_size = PCD_MSG_SIZE;
+    pcd_ring_dev_init(dev_data);
+    xa_init(&dev_data->backing.pages); //the last put frees the backing, probe may fail before pcd_backing_init
+    kref_init(&dev_data->ref); //probe's ref, dropped by remove
+    ret = pcd_stats_alloc(dev_data);
+    if(!ret)
+        ret = pcd_lat_alloc(dev_data);
+    dev_data->inode = alloc_anon_inode(pcdrv_data.mnt->mnt_sb);
+    if(!ret && IS_ERR(dev_data->inode))
+        ret = PTR_ERR(dev_data->inode);
+    if(ret)
+    {
+        dev_info(dev,"Cannot allocate memory\n");
+        goto dev_data_put;
+    }
+    dev_dbg(dev,"Device serial number: %s\n",dev_data->pdata.serial_number);
+    dev_dbg(dev,"Device size: %llu bytes\n",dev_data->pdata.size);
+    dev_dbg(dev,"Device permission: 0x%x\n",dev_data->pdata.perm);
+    dev_dbg(dev,"Device mode: %s\n",pcd_mode_names[dev_data->pdata.mode]);
+    dev_dbg(dev,"Device backing: %s, node %d%s\n",pcd_backing_names[dev_data->pdata.backing],
+            dev_data->pdata.numa_node,dev_data->pdata.prefault ? ", prefault" : "");
 
-    dev_info(dev,"Config Item 1: %d",pcdev_cfg[driver_data].config_item1);
-    dev_info(dev,"Config Item 2: %d",pcdev_cfg[driver_data].config_item2);
+    dev_dbg(dev,"Config Item 1: %d",pcdev_cfg[driver_data].config_item1);
+    dev_dbg(dev,"Config Item 2: %d",pcdev_cfg[driver_data].config_item2);
 
     /* 3. Dynamically allocate memory for device buffer using size information from the platform data */
     //dev_data->buffer = kzalloc(dev_data->pdata.size,GFP_KERNEL);
-    dev_data->buffer = devm_kzalloc(dev,dev_data->pdata.size,GFP_KERNEL); //devm usage
-    if(!dev_data->buffer)
+    /* page array instead of devm_kzalloc: no contiguous memory needed (multi GB devices). Sparse allocates nothing until written */
+    /* on the configured node, else the device's own node rather than wherever this probe happens to run */
+    nid = (dev_data->pdata.numa_node != NUMA_NO_NODE) ? dev_data->pdata.numa_node : dev_to_node(dev);
+    ret = pcd_backing_init(&dev_data->backing,dev_data->pdata.backing,nid);
+    if(ret)
     {
-        dev_info(dev,"Cannot allocate memory\n");
-        ret = -ENOMEM;
-        goto dev_data_free;
+        dev_info(dev,"Cannot set up %s backing\n",pcd_backing_names[dev_data->pdata.backing]);
+        goto dev_data_put;
+    }
+    /* preallocated backings and org,prefault pay for the pages here instead of on first access */
+    populate = (dev_data->pdata.backing == PCD_BACKING_PAGES) || (dev_data->pdata.backing == PCD_BACKING_CONTIG) ||
+               (dev_data->pdata.backing == PCD_BACKING_HUGE) || dev_data->pdata.prefault;
+    if(populate)
+    {
+        ret = pcd_backing_populate(&dev_data->backing,dev_data->pdata.size);
+        if(ret)
+        {
+            dev_info(dev,"Cannot allocate %llu bytes\n",dev_data->pdata.size);
+            goto dev_data_put;
+        }
+    }
+    /* org,replicas: a copy on every other memory node, readers use their local one */
+    if(dev_data->pdata.replicas)
+    {
+        ret = pcd_replicas_init(dev_data,populate);
+        if(ret)
+        {
+            dev_info(dev,"Cannot set up NUMA replicas\n");
+            goto dev_data_put;
+        }
+    }
+    /* org,mode "message": slots of msg_size bytes */
+    if(dev_data->pdata.mode == PCD_MODE_MSG)
+    {
+        ret = pcd_msg_setup(dev_data);
+        if(ret)
+        {
+            dev_info(dev,"Cannot set up the message queue (%llu bytes, %u per record)\n",dev_data->pdata.size,dev_data->msg_size);
+            goto dev_data_put;
+        }
+    }
+    /* org,mode "log": slots of msg_size bytes too */
+    if(dev_data->pdata.mode == PCD_MODE_LOG)
+    {
+        ret = pcd_log_setup(dev_data);
+        if(ret)
+        {
+            dev_info(dev,"Cannot set up the log (%llu bytes, %u per record)\n",dev_data->pdata.size,dev_data->msg_size);
+            goto dev_data_put;
+        }
     }
 
-    /* 4. Get the device number */
-    dev_data->dev_num=pcdrv_data.device_num_base + pcdrv_data.total_devices;
-
-    /* 5. Do cdev init and cdev add */
-    cdev_init(&dev_data->cdev,&pcd_fops);
-    dev_data->cdev.owner=THIS_MODULE;
-    ret = cdev_add(&dev_data->cdev,dev_data->dev_num,1); //add 1 device per loop
+    /* 4. Get the device number. Lowest free minor, recycled on remove. Publishing it makes it openable (one cdev covers all minors) */
+    ret = xa_alloc(&pcdrv_data.devices,&minor,dev_data,XA_LIMIT(0,max_devices - 1),GFP_KERNEL);
     if (ret<0)
     {
-        dev_err(dev,"cdev add failed\n");
-        goto buffer_free;
+        dev_err(dev,"no free minor (max_devices=%u)\n",max_devices);
+        ret = (ret == -EBUSY) ? -ENOSPC : ret;
+        goto dev_data_put;
     }
+    dev_data->dev_num=pcdrv_data.device_num_base + minor;
 
-    /* 6. Create device file for the detected platform device */
-    pcdrv_data.device_pcd = device_create(pcdrv_data.class_pcd,dev,dev_data->dev_num,NULL,"pcdev-%d",pcdrv_data.total_devices); //error handle later
-    if(IS_ERR(pcdrv_data.device_pcd))
+    /* 5. Create device file for the detected platform device */
+    dev_data->device = device_create(pcdrv_data.class_pcd,dev,dev_data->dev_num,NULL,"pcdev-%u",minor);
+    if(IS_ERR(dev_data->device))
     {
         dev_err(dev,"device creation failed\n");
-        ret = PTR_ERR(pcdrv_data.device_pcd);
-        goto cdev_del; //Class already created in platform_driver init (this is in probe function)
+        ret = PTR_ERR(dev_data->device);
+        goto minor_free; //Class already created in platform_driver init (this is in probe function)
     }
 
-    pcdrv_data.total_devices++;
-
-    ret = pcd_sysfs_create_files(pcdrv_data.device_pcd);
+    ret = pcd_sysfs_create_files(dev_data->device);
     if (ret < 0)
-    {
-        device_destroy(pcdrv_data.class_pcd,dev_data->dev_num);
-        return ret;
-    }
+        goto device_del;
 
-    dev_info(dev,"The probe was successful\n");
+    /* latency histograms under /sys/kernel/debug/pcd/pcdev-N */
+    pcd_debugfs_add(dev_data,pcdrv_data.debugfs_root,dev_name(dev_data->device));
+
+    atomic_inc(&pcdrv_data.total_devices);
+    WRITE_ONCE(dev_data->probe_ns,ktime_get_ns() - t0); //probe_time_ns reads 0 until here
+    dev_dbg(dev,"The probe was successful\n");
     return 0;
 
-    /* 7. Error handling */
-cdev_del:
-    cdev_del(&dev_data->cdev);
-buffer_free:
+    /* 6. Error handling */
+device_del:
+    device_unregister(dev_data->device);
+minor_free:
+    /* published: an open may have slipped in between, it holds its own ref and gets -ENODEV */
+    xa_erase(&pcdrv_data.devices,minor);
+    pcd_dev_kill(dev_data);
+    pcd_ring_dev_exit(dev_data); //and may have started a ring thread
+dev_data_put:
     //kfree(dev_data->buffer);
-    devm_kfree(&pdev->dev,dev_data->buffer); //devm function use. Actually it not required. if probe fails, dev resources will be cleared!
-dev_data_free:
     //kfree(dev_data);
-    devm_kfree(&pdev->dev,dev_data); //devm function use. Actually it not required. if probe fails, dev resources will be cleared!
+    pcd_dev_put(dev_data); //frees buffer and private data unless a file still holds them
 out:
     dev_info(dev,"Device probe failed\n");
     return ret;
@@ -255,29 +751,191 @@ int pcd_platform_driver_remove(struct platform_device *pdev)
     struct pcdev_private_data *dev_data;
     struct device *dev = &pdev->dev;
     dev_data = dev_get_drvdata(dev);
-    /* 1. Remove device that's created with device_create */
-    device_destroy(pcdrv_data.class_pcd,dev_data->dev_num);
-    /* 2. Remove a cdev entry from the system */
-    cdev_del(&dev_data->cdev);
-    /* 3. Free the memory held by the device */
-    //kfree(dev_data->buffer); //N/R because devm function used in probe function
-    //kfree(dev_data); //N/R because devm function used in probe function
-    pcdrv_data.total_devices--;
-    dev_info(dev,"A device is removed\n");
+    /* 1. No new opens, the minor is free for the next probe. Files already open now get -ENODEV */
+    xa_erase(&pcdrv_data.devices,MINOR(dev_data->dev_num));
+    pcd_dev_kill(dev_data);
+    pcd_debugfs_remove(dev_data);
+    pcd_ring_dev_exit(dev_data); //stop the ring polling thread
+    /* 2. Remove device that's created with device_create. device_destroy would search the class by dev_t */
+    device_unregister(dev_data->device);
+    /* 3. Free the memory held by the device, or leave it to the last open file, mapping or ring */
+    //kfree(dev_data->buffer);
+    //kfree(dev_data);
+    atomic_dec(&pcdrv_data.total_devices);
+    pcd_dev_put(dev_data);
+    dev_dbg(dev,"A device is removed\n");
     return 0;
 }
 
+/*********************** Live DT updates ***********************/
+
+/*
+ * Property changes on a bound pcdev node (overlay applied/removed, of_update_property) reach the live
+ * device, open files included, instead of needing an unbind/rebind:
+ * size and mode go through the same paths as their sysfs attributes (contents kept, I/O keeps running),
+ * perm applies to later opens and mmaps (like a chmod, files already open keep their access).
+ * The rest (serial number, backing, numa node, prefault) only applies on the next probe.
+ * The notifier can't veto a change: overlays notify after applying it and ignore errors. A value the
+ * device can't take (invalid, or -EBUSY/-ENOMEM from the live path) is logged, the device keeps its old
+ * value and the DT and the device disagree until the next probe (or a change that applies).
+ */
+
+/* prop value as a string, NULL if it isn't one */
+static const char *pcd_of_prop_string(const struct property *prop)
+{
+    if(!prop->value || !prop->length || (strnlen(prop->value,prop->length) >= prop->length))
+        return NULL;
+    return prop->value;
+}
+
+static int pcd_of_apply(struct pcdev_private_data *dev_data, struct device_node *dn, unsigned long action, struct property *prop)
+{
+    bool removed = (action == OF_RECONFIG_REMOVE_PROPERTY);
+    const char *str = NULL;
+    u64 size;
+    u32 perm;
+    int mode;
+
+    if(!strcmp(prop->name,"org,size"))
+    {
+        if(removed)
+            return -EINVAL; //required property
+        of_property_read_string(dn,"org,size-unit",&str);
+        if(pcdev_dt_size(prop,str,&size))
+            return -EINVAL;
+        return pcd_dev_resize(dev_data,size);
+    }
+    if(!strcmp(prop->name,"org,size-unit"))
+    {
+        /* removed: back to bytes */
+        if(!removed && !(str = pcd_of_prop_string(prop)))
+            return -EINVAL;
+        if(pcdev_dt_size(of_find_property(dn,"org,size",NULL),str,&size))
+            return -EINVAL;
+        return pcd_dev_resize(dev_data,size);
+    }
+    if(!strcmp(prop->name,"org,perm"))
+    {
+        if(removed || !prop->value || (prop->length != sizeof(u32)))
+            return -EINVAL;
+        perm = be32_to_cpup(prop->value);
+        if((perm != DEV_DRV_PERM_RDONLY) && (perm != DEV_DRV_PERM_WRONLY) && (perm != DEV_DRV_PERM_RDWR))
+            return -EINVAL;
+        WRITE_ONCE(dev_data->pdata.perm,perm);
+        dev_info(dev_data->device,"Device permission changed to 0x%x\n",perm);
+        return PCD_DRV_SUCCESS;
+    }
+    if(!strcmp(prop->name,"org,mode"))
+    {
+        mode = PCD_MODE_ARRAY; //removed: back to the default
+        if(!removed)
+        {
+            str = pcd_of_prop_string(prop);
+            mode = str ? match_string(pcd_mode_names,ARRAY_SIZE(pcd_mode_names),str) : -EINVAL;
+            if(mode < 0)
+                return -EINVAL;
+        }
+        if(mode == READ_ONCE(dev_data->pdata.mode))
+            return PCD_DRV_SUCCESS; //a switch empties the ring, don't for nothing
+        return pcd_dev_set_mode(dev_data,mode);
+    }
+    if(!strncmp(prop->name,"org,",4))
+        dev_info(dev_data->device,"%s change applies on the next probe\n",prop->name);
+    return PCD_DRV_SUCCESS;
+}
+
+static int pcd_of_notify(struct notifier_block *nb, unsigned long action, void *arg)
+{
+    struct of_reconfig_data *rd = arg;
+    struct pcdev_private_data *dev_data;
+    struct platform_device *pdev;
+    int ret = PCD_DRV_SUCCESS;
+
+    switch(action)
+    {
+        case OF_RECONFIG_ADD_PROPERTY:
+        case OF_RECONFIG_REMOVE_PROPERTY:
+        case OF_RECONFIG_UPDATE_PROPERTY:
+            break;
+        default:
+            return NOTIFY_DONE; //node attach/detach: the platform core creates/deletes the device, probe/remove follow
+    }
+    if(!of_match_node(org_pcdev_dt_match,rd->dn))
+        return NOTIFY_DONE;
+    pdev = of_find_device_by_node(rd->dn);
+    if(!pdev)
+        return NOTIFY_DONE;
+
+    /* holds off probe/remove: bound to us with its private data for as long as we use it */
+    device_lock(&pdev->dev);
+    dev_data = platform_get_drvdata(pdev);
+    if((pdev->dev.driver == &pcd_platform_driver.driver) && dev_data)
+        ret = pcd_of_apply(dev_data,rd->dn,action,rd->prop);
+    device_unlock(&pdev->dev);
+    if(ret)
+        dev_warn(&pdev->dev,"Cannot apply %s: %d, device keeps its old value (DT differs until the next probe)\n",rd->prop->name,ret);
+    put_device(&pdev->dev);
+    return NOTIFY_OK;
+}
+
+static struct notifier_block pcd_of_nb =
+{
+    .notifier_call = pcd_of_notify
+};
+static bool pcd_of_nb_registered;
+
 /*********************** Driver init/exit functions ***********************/
 
+/* Pseudo fs for the device mapping inodes, never mounted in userspace */
+static int pcd_fs_init_fs_context(struct fs_context *fc)
+{
+    return init_pseudo(fc,PCD_FS_MAGIC) ? 0 : -ENOMEM;
+}
+
+static struct file_system_type pcd_fs_type =
+{
+    .name = "pcd",
+    .owner = THIS_MODULE,
+    .init_fs_context = pcd_fs_init_fs_context,
+    .kill_sb = kill_anon_super
+};
+
 static int __init pcd_platform_driver_init(void)
 {   
     int ret=0;
-    pcdrv_data.total_devices=0;//Initializing devices count. Increment/Decrement will happen when new device detected/removed in probe/remove functions respectively.
-    /* 1. Dynamically allocate device number for MAX_DEVICES */
-    ret=alloc_chrdev_region(&pcdrv_data.device_num_base,0,MAX_DEVICES,"pcd_devices"); //it can fail. Handle error
+    atomic_set(&pcdrv_data.total_devices,0);//Initializing devices count. Increment/Decrement will happen when new device detected/removed in probe/remove functions respectively.
+    xa_init_flags(&pcdrv_data.devices,XA_FLAGS_ALLOC); //minor -> device private data
+    if ((max_devices == 0) || (max_devices > MINORMASK + 1))
+    {
+        pr_err("max_devices must be 1..%u\n",MINORMASK + 1);
+        return -EINVAL;
+    }
+    /* 0. Home of the device mapping inodes (pcd_dev_unmap) */
+    pcdrv_data.mnt = kern_mount(&pcd_fs_type);
+    if (IS_ERR(pcdrv_data.mnt))
+    {
+        pr_err("pcd pseudo fs mount failed\n");
+        return PTR_ERR(pcdrv_data.mnt);
+    }
+    /* 1. Dynamically allocate device numbers for max_devices */
+    ret=alloc_chrdev_region(&pcdrv_data.device_num_base,0,max_devices,"pcd_devices"); //it can fail. Handle error
     if (ret<0)
     {
         pr_err("alloc char dev failed\n");
+        kern_unmount(pcdrv_data.mnt);
+        return ret;
+    }
+
+    /* One cdev for the whole region, open looks the device up by minor. A cdev per device would put
+       thousands of entries on the same chrdev map chain (linear probe/open cost) */
+    cdev_init(&pcdrv_data.cdev,&pcd_fops);
+    pcdrv_data.cdev.owner=THIS_MODULE;
+    ret = cdev_add(&pcdrv_data.cdev,pcdrv_data.device_num_base,max_devices);
+    if (ret<0)
+    {
+        pr_err("cdev add failed\n");
+        unregister_chrdev_region(pcdrv_data.device_num_base,max_devices);
+        kern_unmount(pcdrv_data.mnt);
         return ret;
     }
 
@@ -291,27 +949,54 @@ static int __init pcd_platform_driver_init(void)
     {
         pr_err("class creation failed\n");
         ret = PTR_ERR(pcdrv_data.class_pcd);
-        unregister_chrdev_region(pcdrv_data.device_num_base,MAX_DEVICES);
+        cdev_del(&pcdrv_data.cdev);
+        unregister_chrdev_region(pcdrv_data.device_num_base,max_devices);
+        kern_unmount(pcdrv_data.mnt);
         return ret;
     }
 
+    /* debugfs root for the latency histograms. Not fatal if debugfs is missing */
+    pcdrv_data.debugfs_root = debugfs_create_dir("pcd",NULL);
+
     /* 3. Register a platform driver */
     platform_driver_register(&pcd_platform_driver); //Error handle later
 
+    /* 4. /sys/kernel/config/pcd for devices created at runtime. Not fatal without configfs */
+    if (pcd_configfs_init())
+        pr_warn("configfs registration failed, runtime devices unavailable\n");
+
+    /* 5. Live DT property updates. Without CONFIG_OF_DYNAMIC the DT can't change at runtime anyway */
+    if (IS_ENABLED(CONFIG_OF_DYNAMIC))
+    {
+        pcd_of_nb_registered = !of_reconfig_notifier_register(&pcd_of_nb);
+        if (!pcd_of_nb_registered)
+            pr_warn("OF reconfig notifier registration failed, DT updates need a rebind\n");
+    }
+
     pr_info("PCD-Platform driver Module loaded\n");
     return 0;
 }
 
 static void __exit pcd_platform_driver_cleanup(void)
 {
+    /* 0. No items can exist here (each one pins the module), just drop the subsystem */
+    pcd_configfs_exit();
+    if (pcd_of_nb_registered)
+        of_reconfig_notifier_unregister(&pcd_of_nb);
+
     /* 1. Unregister platform driver */
     platform_driver_unregister(&pcd_platform_driver);
 
+    debugfs_remove_recursive(pcdrv_data.debugfs_root);
+
     /* 2. Class destroy */
     class_destroy(pcdrv_data.class_pcd);
 
-    /* 3. Unregister char dev region (all device numbers for MAX_DEVICES) */
-    unregister_chrdev_region(pcdrv_data.device_num_base,MAX_DEVICES);
+    /* 3. Remove the cdev and unregister char dev region (all device numbers for max_devices) */
+    cdev_del(&pcdrv_data.cdev);
+    unregister_chrdev_region(pcdrv_data.device_num_base,max_devices);
+    xa_destroy(&pcdrv_data.devices);
+    kern_unmount(pcdrv_data.mnt); //the last device data is gone with the last file, which pinned the module
 
     pr_info("PCD-Platform driver Module unloaded\n");
 }
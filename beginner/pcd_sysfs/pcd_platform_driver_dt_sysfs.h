@@ -15,8 +15,48 @@
 #include <linux/mod_devicetable.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
+#include <linux/of_platform.h> //for of_find_device_by_node
+#include <linux/mm.h>
+#include <linux/uio.h> //for iov_iter (read_iter/write_iter)
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sched/clock.h> //for local_clock
+#include <linux/sizes.h>
+#include <linux/xarray.h>
+#include <linux/highmem.h>
+#include <linux/configfs.h>
+#include <linux/shmem_fs.h>
+#include <linux/numa.h>
+#include <linux/ktime.h> //for ktime_get_ns (probe time)
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
+#include <linux/bvec.h>
+#include <linux/file.h> //for fget/fput (copy range source)
+#include <linux/capability.h>
+#include <linux/kthread.h>
+#include <linux/anon_inodes.h>
+#include <linux/sched/mm.h> //for mmgrab/mmget_not_zero (ring address space)
+#include <linux/vmalloc.h>
+#include <linux/kref.h>
+#include <linux/rcupdate.h>
+#include <linux/pseudo_fs.h> //for init_pseudo (device mapping inodes)
+#include <linux/mount.h>
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 6, 0 ) ) // Hack to support newer kernel versions (host linux is newer currently)
+#include <linux/io_uring/cmd.h>
+#elif ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 1, 0 ) )
+#include <linux/io_uring.h>
+#endif
 
 #include "platform.h"
+#include "pcd_ioctl.h"
 
 //*************************Pre-processor macros*****************************//
 #define MEM_SIZE_MAX_PCDEV1 1024
@@ -25,9 +65,19 @@
 #define MEM_SIZE_MAX_PCDEV4 512
 
 #define NO_OF_DEVICES 4 //UNUSED
-#define MAX_DEVICES 10
+#define MAX_DEVICES 1024 //default of the max_devices module parameter
+#define PCD_NR_MODES 4 //PCD_MODE_ARRAY, PCD_MODE_FIFO, PCD_MODE_MSG, PCD_MODE_LOG
+#define PCD_NR_BACKINGS 5 //PCD_BACKING_*
+
+#define PCD_MSG_SIZE 256 //default msg_size: max record bytes in message and log mode
+#define PCD_RING_IDLE_US 1000000 //default ring_idle_us: the polling thread spins 1s after the last SQE, then sleeps
+
+/* latency histograms: transfer size classes x log2(ns) buckets, per op */
+#define PCD_LAT_CLASSES 4
+#define PCD_LAT_BUCKETS 32
 
 /* LOCAL ERROR/STATUS DEFINES */
+#define PCD_FS_MAGIC 0x70636466 //"pcdf", pseudo fs of the device mapping inodes
 #define PCD_DRV_SUCCESS 0
 
 #define pr_fmt(fmt) "%s : "fmt,__func__ //WARNING EXPECTED. redefined pr_fmt. and it works because kernel builds these cases for pr_* cases
@@ -38,9 +88,37 @@ typedef enum
     PCDEVA1X,
     PCDEVB1X,
     PCDEVC1X,
-    PCDEVD1X
+    PCDEVD1X,
+    PCDEVCFS //created at runtime through configfs
 }DeviceIds;
 
+/* Per device I/O counters (stats sysfs group) */
+enum pcd_stat
+{
+    PCD_STAT_READS,
+    PCD_STAT_WRITES,
+    PCD_STAT_SEEKS,
+    PCD_STAT_BYTES_READ,
+    PCD_STAT_BYTES_WRITTEN,
+    PCD_STAT_SHORT, //transfers that moved less than requested
+    PCD_STAT_EFAULT,
+    PCD_STAT_ENOMEM,
+    PCD_STAT_OPENS,
+    PCD_STAT_FAULTS_HUGE, //mmap faults handed a page of a PMD sized folio, mappable with one PMD
+    PCD_STAT_FAULTS_SMALL, //mmap faults mapped with a PTE
+    PCD_STAT_NR
+};
+
+/* File ops with a latency histogram (debugfs) */
+enum pcd_lat_op
+{
+    PCD_LAT_OPEN,
+    PCD_LAT_READ,
+    PCD_LAT_WRITE,
+    PCD_LAT_LSEEK,
+    PCD_LAT_OPS
+};
+
 //************************* STRUCTS *****************************//
 
 struct device_config 
@@ -49,39 +127,399 @@ struct device_config
     int config_item2;
 };
 
+/* One locked byte range [start,end), lives on the locker's stack */
+struct pcd_range
+{
+    loff_t start;
+    loff_t end;
+    struct list_head node;
+};
+
+/* Byte range locks held by writers of one device */
+struct pcd_range_lock
+{
+    spinlock_t lock;
+    struct list_head held;
+    wait_queue_head_t wq;
+};
+
+/* FIFO mode ring over the device buffer. head/tail are free running byte counters */
+struct pcd_fifo
+{
+    unsigned long head; //only moved by the producer
+    unsigned long tail; //only moved by the consumer
+    wait_queue_head_t rd_wq;
+    wait_queue_head_t wr_wq;
+    struct mutex rd_lock; //one consumer at a time
+    struct mutex wr_lock; //one producer at a time
+};
+
+/* One slot of the message queue. seq says whose turn it is: producer of pos when seq == pos, consumer when pos + 1 */
+struct pcd_msg_slot
+{
+    atomic_long_t seq;
+    u32 len; //record bytes
+};
+
+/* PCD_MODE_MSG queue over the device buffer, slot i at i * slot_size (pcd_msg.c) */
+struct pcd_msgq
+{
+    atomic_long_t enq_pos ____cacheline_aligned_in_smp; //next position producers claim
+    atomic_long_t deq_pos ____cacheline_aligned_in_smp; //next position consumers claim
+    struct pcd_msg_slot *slots; //NULL outside message mode
+    unsigned long mask; //slots - 1
+    u32 slot_size; //max record bytes
+    wait_queue_head_t rd_wq;
+    wait_queue_head_t wr_wq;
+};
+
+/* One slot of the log. seq: number of the record in it, published with release, PCD_LOG_BUSY while written */
+struct pcd_log_slot
+{
+    atomic64_t seq;
+    u32 len; //record bytes
+};
+
+/* PCD_MODE_LOG log over the device buffer, record n in slot n & mask at (n & mask) * slot_size (pcd_log.c) */
+struct pcd_log
+{
+    atomic64_t head ____cacheline_aligned_in_smp; //number of the next record appended
+    struct pcd_log_slot *slots; //NULL outside log mode
+    unsigned long mask; //slots - 1
+    u32 slot_size; //max record bytes
+    wait_queue_head_t rd_wq;
+    wait_queue_head_t wr_wq; //writers waiting for the previous lap's writer of their slot
+};
+
+/* Device memory: page index -> page, allocated on first write or at probe depending on type (pcd_backing.c) */
+struct pcd_backing
+{
+    struct xarray pages;
+    atomic_long_t nr_resident; //pages allocated
+    int type; //PCD_BACKING_*
+    int nid; //node pages are allocated on
+    struct file *shmem; //PCD_BACKING_SHMEM: pages live in this file's page cache, not in the xarray
+    bool cow; //pages were ever shared copy on write with another backing, writers check before writing
+};
+
+/* Per NUMA node copy of the device (org,replicas) */
+struct pcd_replica
+{
+    struct pcd_backing backing;
+    bool used; //backing initialized, freed at unbind
+    bool valid; //up to date, reads may use it
+};
+
+/* Submission/completion ring pair (pcd_ring.c), the private data of a ring fd */
+struct pcd_ring
+{
+    struct pcd_ring_hdr *hdr; //start of the area user space maps (vmalloc_user)
+    struct pcd_sqe *sqes;
+    struct pcd_cqe *cqes;
+    u32 sq_mask;
+    u32 cq_mask;
+    u32 cq_entries;
+    /* kernel side indexes, published to hdr after every entry. User space can't move them under us */
+    u32 sq_head;
+    u32 cq_tail;
+    bool sqpoll;
+    struct file *file; //pcdev file the SQEs go to, ref held
+    struct pcdev_private_data *dev_data;
+    struct mm_struct *mm; //address space of the SQE buffers (mmgrab ref)
+    struct mutex lock; //one consumer of the SQ at a time
+    struct list_head node; //on dev_data->rings (PCD_RING_SQPOLL)
+};
+
+/* Per cpu copy of the counters, summed on read */
+struct pcd_stats
+{
+    u64_stats_t cnt[PCD_STAT_NR];
+    struct u64_stats_sync syncp;
+};
+
+/* Per cpu latency histograms, bucket b counts ops that took [2^(b-1), 2^b) ns */
+struct pcd_lat_hist
+{
+    u64 bucket[PCD_LAT_OPS][PCD_LAT_CLASSES][PCD_LAT_BUCKETS];
+};
+
 /* Device private data struct */
 struct pcdev_private_data
 {
+    /* probe holds a ref until remove, every open file, mapping and ring one more: the last one frees */
+    struct kref ref;
+    bool dead; //removed, what still has it gets -ENODEV. Set under resize_lock and buf_sem exclusive
+    /* anon inode of the driver's pseudo fs: every open file maps through its i_mapping, whatever node it was opened by,
+    so all mappings of the device can be zapped in one go (pcd_dev_unmap) */
+    struct inode *inode;
     struct pcdev_platform_data pdata;
-    char *buffer;
+    struct pcd_backing backing;
     dev_t dev_num;
-    struct cdev cdev;
+    struct device *device; //pcdev-N class device
+    /* live device size. Resized online, pdata.size is only the size the device was probed with */
+    atomic64_t size;
+    struct mutex resize_lock; //one resize/mode change at a time
+    /* pdata.mode: shared by readers/writers/hole punch, exclusive for a mode change */
+    struct rw_semaphore buf_sem;
+    /* writers additionally lock the byte range they touch */
+    struct pcd_range_lock wr_ranges;
+    /* PCD_MODE_FIFO state */
+    struct pcd_fifo fifo;
+    /* PCD_MODE_MSG/PCD_MODE_LOG state. msg_size: record size of the next switch to either (msg_size attribute) */
+    struct pcd_msgq msgq;
+    struct pcd_log log;
+    unsigned int msg_size;
+    /* I/O statistics. stats_base holds the sums at the last reset */
+    struct pcd_stats __percpu *stats;
+    struct mutex stats_lock;
+    u64 stats_base[PCD_STAT_NR];
+    /* latency histograms and their debugfs directory */
+    struct pcd_lat_hist __percpu *lat;
+    struct dentry *debugfs_dir;
+    /* how long the probe of this device took */
+    u64 probe_ns;
+    /* org,replicas: nr_node_ids entries, NULL without replicas. replica_lock orders replica updates */
+    struct pcd_replica *replicas;
+    struct mutex replica_lock;
+    /* PCD_RING_SQPOLL rings and the thread polling them (started by the first one, stopped on remove) */
+    struct list_head rings;
+    struct mutex ring_lock;
+    struct task_struct *ring_thread;
+    wait_queue_head_t ring_wq;
+    bool ring_kick; //PCD_RING_IOC_ENTER since the thread last woke
+    unsigned int ring_idle_us; //ring_idle_us attribute: busy polling time before sleeping
 };
 
 /* Driver private data struct */
 struct pcdrv_private_data
 {
-    int total_devices;
+    atomic_t total_devices;
     /* holds device number of base (first device) of all allocated devices */
     dev_t device_num_base;
-    /* Device class/device structs */
+    /* one cdev for all minors, minor -> struct pcdev_private_data (allocating xarray, minors are recycled) */
+    struct cdev cdev;
+    struct xarray devices;
+    /* Device class struct */
     struct class *class_pcd;
-    struct device *device_pcd;
+    /* debugfs "pcd" directory, parent of the per device directories */
+    struct dentry *debugfs_root;
+    /* internal pseudo fs, home of the per device mapping inodes */
+    struct vfsmount *mnt;
 };
 
+//************************* INLINE HELPERS *****************************//
+
+/* vm_flags is read only for drivers from 6.3 onwards. Hack to support newer kernel versions (host linux is newer currently) */
+static inline void pcd_vm_flags_mod(struct vm_area_struct *vma, vm_flags_t set, vm_flags_t clear)
+{
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 3, 0 ) )
+    vm_flags_mod(vma,set,clear);
+    #else
+    vma->vm_flags = (vma->vm_flags | set) & ~clear;
+    #endif
+}
+
+/*
+ * Fault in the user pages of the next bytes of a write source, so it can be copied with page faults off.
+ * True when at least some of it could be. Renamed in 5.16, hack to support newer kernel versions (host linux is newer currently)
+ */
+static inline bool pcd_fault_in_readable(struct iov_iter *from, size_t bytes)
+{
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 5, 16, 0 ) )
+    return fault_in_iov_iter_readable(from,bytes) < bytes;
+    #else
+    return !iov_iter_fault_in_readable(from,bytes);
+    #endif
+}
+
+static inline void pcd_dev_get(struct pcdev_private_data *pcdev_data)
+{
+    kref_get(&pcdev_data->ref);
+}
+
+/* Removed while still open (or mapped): nothing more to do with it */
+static inline bool pcd_dev_dead(struct pcdev_private_data *pcdev_data)
+{
+    return READ_ONCE(pcdev_data->dead);
+}
+
+/* Wakeup condition of the blocking modes: true once the device left mode or was removed, the sleeper goes and finds out */
+static inline bool pcd_dev_left_mode(struct pcdev_private_data *pcdev_data, int mode)
+{
+    return (READ_ONCE(pcdev_data->pdata.mode) != mode) || pcd_dev_dead(pcdev_data);
+}
+
+/* Current device size. Sample it once per op, a concurrent resize may change it any time */
+static inline loff_t pcd_dev_size(struct pcdev_private_data *pcdev_data)
+{
+    return atomic64_read(&pcdev_data->size);
+}
+
+/* Backing reads come from: the local node's replica when there is an up to date one, the device backing otherwise */
+static inline struct pcd_backing *pcd_read_backing(struct pcdev_private_data *pcdev_data)
+{
+    struct pcd_replica *replica;
+
+    if (likely(!pcdev_data->replicas))
+        return &pcdev_data->backing;
+    replica = &pcdev_data->replicas[numa_node_id()];
+    return READ_ONCE(replica->valid) ? &replica->backing : &pcdev_data->backing;
+}
+
+/* Lock free counter update from the file ops */
+static inline void pcd_stats_inc(struct pcdev_private_data *pcdev_data, enum pcd_stat id)
+{
+    struct pcd_stats *stats = get_cpu_ptr(pcdev_data->stats);
+    u64_stats_update_begin(&stats->syncp);
+    u64_stats_inc(&stats->cnt[id]);
+    u64_stats_update_end(&stats->syncp);
+    put_cpu_ptr(pcdev_data->stats);
+}
+
+/* Account one read/write: requested is what the caller asked for, ret what the op returned */
+static inline void pcd_stats_rw(struct pcdev_private_data *pcdev_data, bool write, size_t requested, ssize_t ret)
+{
+    struct pcd_stats *stats = get_cpu_ptr(pcdev_data->stats);
+    u64_stats_update_begin(&stats->syncp);
+    u64_stats_inc(&stats->cnt[write ? PCD_STAT_WRITES : PCD_STAT_READS]);
+    if (ret >= 0)
+    {
+        u64_stats_add(&stats->cnt[write ? PCD_STAT_BYTES_WRITTEN : PCD_STAT_BYTES_READ],ret);
+        if ((size_t)ret < requested)
+            u64_stats_inc(&stats->cnt[PCD_STAT_SHORT]);
+    }
+    else if (ret == -EFAULT)
+        u64_stats_inc(&stats->cnt[PCD_STAT_EFAULT]);
+    else if (ret == -ENOMEM)
+        u64_stats_inc(&stats->cnt[PCD_STAT_ENOMEM]);
+    u64_stats_update_end(&stats->syncp);
+    put_cpu_ptr(pcdev_data->stats);
+}
+
+/* Driver private data, mode names and file ops, defined in pcd_platform_driver_dt_sysfs.c */
+extern struct pcdrv_private_data pcdrv_data;
+extern const char * const pcd_mode_names[PCD_NR_MODES];
+extern const char * const pcd_backing_names[PCD_NR_BACKINGS];
+extern struct file_operations pcd_fops;
+
 //************************* FUNCTION DECLARATIONS *****************************//
 
 /* File ops (system call functions) */
 loff_t pcd_lseek(struct file *filep, loff_t offset, int whence);
-ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_pos);
-ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos);
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from);
 int pcd_open(struct inode *inode, struct file *filep);
 int pcd_release(struct inode *inode, struct file *filep);
+int pcd_mmap(struct file *filep, struct vm_area_struct *vma);
+#if ( LINUX_VERSION_CODE < KERNEL_VERSION( 5, 18, 0 ) )
+unsigned long pcd_get_unmapped_area(struct file *filep, unsigned long addr, unsigned long len, unsigned long pgoff, unsigned long flags);
+#endif
+ssize_t pcd_splice_read(struct file *filep, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags);
 int check_permission(int dev_perm, int access_mode);
+__poll_t pcd_poll(struct file *filep, poll_table *wait);
+long pcd_ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 1, 0 ) )
+int pcd_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+#endif
+
+/* Batched I/O (ioctl, io_uring and ring SQEs) */
+ssize_t pcd_batch_one(struct file *filep, struct pcdev_private_data *pcdev_data, struct pcd_io_desc *desc, bool nowait);
+
+/* Submission/completion rings */
+void pcd_ring_dev_init(struct pcdev_private_data *dev_data);
+void pcd_ring_dev_exit(struct pcdev_private_data *dev_data);
+long pcd_ring_setup(struct file *filep, struct pcdev_private_data *pcdev_data, void __user *argp);
+
+/* FIFO mode */
+void pcd_fifo_init(struct pcd_fifo *fifo);
+void pcd_fifo_reset(struct pcd_fifo *fifo);
+ssize_t pcd_fifo_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_fifo_write_iter(struct kiocb *iocb, struct iov_iter *from);
+__poll_t pcd_fifo_poll(struct file *filep, poll_table *wait);
+
+/* Message mode */
+void pcd_msg_init(struct pcd_msgq *q);
+int pcd_msg_setup(struct pcdev_private_data *dev_data);
+void pcd_msg_teardown(struct pcdev_private_data *dev_data);
+ssize_t pcd_msg_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_msg_write_iter(struct kiocb *iocb, struct iov_iter *from);
+__poll_t pcd_msg_poll(struct file *filep, poll_table *wait);
+
+/* Log mode */
+void pcd_log_init(struct pcd_log *log);
+int pcd_log_setup(struct pcdev_private_data *dev_data);
+void pcd_log_teardown(struct pcdev_private_data *dev_data);
+loff_t pcd_log_open_pos(struct pcdev_private_data *pcdev_data);
+ssize_t pcd_log_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_log_write_iter(struct kiocb *iocb, struct iov_iter *from);
+loff_t pcd_log_lseek(struct file *filep, loff_t offset, int whence);
+__poll_t pcd_log_poll(struct file *filep, poll_table *wait);
+
+/* Backing store */
+int pcd_backing_init(struct pcd_backing *backing, int type, int nid);
+void pcd_backing_free(struct pcd_backing *backing);
+int pcd_backing_populate(struct pcd_backing *backing, loff_t size);
+int pcd_backing_copy(struct pcd_backing *dst, struct pcd_backing *src, loff_t start, loff_t end);
+unsigned long pcd_backing_resident(struct pcd_backing *backing);
+struct page *pcd_backing_get_page(struct pcd_backing *backing, pgoff_t index, bool alloc);
+bool pcd_backing_page_private(struct pcd_backing *backing, pgoff_t index, struct page *page);
+ssize_t pcd_backing_clone(struct pcd_backing *dst, loff_t dst_pos, struct pcd_backing *src, loff_t src_pos, size_t len, bool share);
+void pcd_backing_punch(struct pcd_backing *backing, loff_t start, loff_t end);
+void pcd_backing_truncate(struct pcd_backing *backing, loff_t size);
+size_t pcd_backing_to_iter(struct pcd_backing *backing, loff_t pos, size_t count, struct iov_iter *to);
+ssize_t pcd_backing_from_iter(struct pcd_backing *backing, loff_t pos, size_t count, struct iov_iter *from, bool nowait);
+loff_t pcd_backing_seek_data_hole(struct pcd_backing *backing, loff_t offset, loff_t size, int whence);
+
+/* NUMA read replicas */
+int pcd_replicas_init(struct pcdev_private_data *dev_data, bool populate);
+void pcd_replicas_free(struct pcdev_private_data *dev_data);
+void pcd_replicas_sync(struct pcdev_private_data *dev_data, loff_t start, loff_t end);
+void pcd_replicas_punch(struct pcdev_private_data *dev_data, loff_t start, loff_t end);
+void pcd_replicas_truncate(struct pcdev_private_data *dev_data, loff_t size);
+unsigned long pcd_replicas_resident(struct pcdev_private_data *dev_data);
+
+/* Byte range locks */
+void pcd_range_lock_init(struct pcd_range_lock *rl);
+int pcd_range_lock(struct pcd_range_lock *rl, struct pcd_range *range, loff_t start, loff_t end, bool nowait);
+void pcd_range_unlock(struct pcd_range_lock *rl, struct pcd_range *range);
+
+/* Statistics */
+int pcd_stats_alloc(struct pcdev_private_data *dev_data);
+void pcd_stats_free(struct pcdev_private_data *dev_data);
+int pcd_stats_snapshot(struct pcdev_private_data *dev_data, struct pcd_stats_snap *snap, bool nowait);
+extern const struct attribute_group pcd_stats_group;
+
+/* Latency histograms (debugfs) */
+int pcd_lat_alloc(struct pcdev_private_data *dev_data);
+void pcd_lat_free(struct pcdev_private_data *dev_data);
+void pcd_lat_record(struct pcdev_private_data *pcdev_data, enum pcd_lat_op op, size_t bytes, u64 start_ns);
+void pcd_debugfs_add(struct pcdev_private_data *dev_data, struct dentry *root, const char *name);
+void pcd_debugfs_remove(struct pcdev_private_data *dev_data);
+
+/* Configfs (runtime created devices) */
+int pcd_configfs_init(void);
+void pcd_configfs_exit(void);
+
+/* Online resize (max_size attribute, DT updates, io_uring) */
+int pcd_dev_resize(struct pcdev_private_data *dev_data, u64 result);
+
+/* Device lifetime and user mappings */
+void pcd_dev_put(struct pcdev_private_data *dev_data);
+void pcd_dev_unmap(struct pcdev_private_data *dev_data, loff_t start, loff_t len, bool even_cows);
 
 /* Sysfs attributes */
 ssize_t show_max_size(struct device *dev, struct device_attribute *attr, char *buf);
 ssize_t show_serial_num(struct device *dev, struct device_attribute *attr, char *buf);
 ssize_t store_max_size(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+ssize_t show_mode(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t show_resident_bytes(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t show_probe_time_ns(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t show_backing(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t show_numa_node(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t show_msg_size(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t store_msg_size(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+ssize_t show_ring_idle_us(struct device *dev, struct device_attribute *attr, char *buf);
+ssize_t store_ring_idle_us(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+ssize_t store_mode(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 
 #endif //PCD_PLATFORM_DRIVER_DT_SYSFS_H
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*
+ * Byte range locks for pcdev buffers.
+ * Writers lock [start,end) of the buffer so that writers on non overlapping regions of the same
+ * device run in parallel. Readers never take these (they only hold buf_sem shared).
+ * Held ranges live in a short list, a waiter sleeps until its range stops overlapping.
+ */
+
+//************************* FUNCTIONS *****************************//
+
+void pcd_range_lock_init(struct pcd_range_lock *rl)
+{
+    spin_lock_init(&rl->lock);
+    INIT_LIST_HEAD(&rl->held);
+    init_waitqueue_head(&rl->wq);
+}
+
+/* Insert the range if nothing held overlaps it */
+static bool pcd_range_try_insert(struct pcd_range_lock *rl, struct pcd_range *range)
+{
+    struct pcd_range *r;
+    bool ok = true;
+
+    spin_lock(&rl->lock);
+    list_for_each_entry(r,&rl->held,node)
+    {
+        if ((range->start < r->end) && (r->start < range->end))
+        {
+            ok = false;
+            break;
+        }
+    }
+    if (ok)
+        list_add(&range->node,&rl->held);
+    spin_unlock(&rl->lock);
+    return ok;
+}
+
+/* Returns 0 with the range held, -EAGAIN for nowait callers or -ERESTARTSYS on a fatal signal */
+int pcd_range_lock(struct pcd_range_lock *rl, struct pcd_range *range, loff_t start, loff_t end, bool nowait)
+{
+    range->start = start;
+    range->end = end;
+
+    if (pcd_range_try_insert(rl,range))
+        return PCD_DRV_SUCCESS;
+    if (nowait)
+        return -EAGAIN;
+    return wait_event_killable(rl->wq,pcd_range_try_insert(rl,range));
+}
+
+void pcd_range_unlock(struct pcd_range_lock *rl, struct pcd_range *range)
+{
+    spin_lock(&rl->lock);
+    list_del(&range->node);
+    spin_unlock(&rl->lock);
+    wake_up_all(&rl->wq);
+}
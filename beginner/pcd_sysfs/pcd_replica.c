@@ -0,0 +1,132 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*
+ * Per NUMA node read replicas (org,replicas).
+ * Every node with memory, other than the one the device's own backing lives on, gets a full copy of
+ * the device on its own memory. Reads are served from the replica of the reading CPU's node
+ * (pcd_read_backing), so readers on every socket stay on local memory.
+ * Writes, hole punches and shrinks go to the device backing first, then to every replica. Replicas
+ * make writes cost once per node: meant for read mostly devices, loaded once, then read only.
+ * A replica that can't keep up (no memory for a page) is dropped, its node reads the device backing.
+ *
+ * Locking: replica updates run under the writer range lock of what they touch, like the backing update
+ * itself. Updates copy whole pages, which can cover bytes of neighbouring writers, so they are also
+ * serialized on replica_lock: each copy runs after its own backing write and reads the latest backing
+ * contents, the last copy of a page always carries every write to it.
+ */
+
+//************************* FUNCTIONS *****************************//
+
+/* Set up a replica per memory node. populate: allocate them fully now, like the device backing */
+int pcd_replicas_init(struct pcdev_private_data *dev_data, bool populate)
+{
+    struct pcd_replica *replicas;
+    int nid, ret;
+
+    replicas = kcalloc(nr_node_ids,sizeof(*replicas),GFP_KERNEL);
+    if (!replicas)
+        return -ENOMEM;
+    mutex_init(&dev_data->replica_lock);
+    dev_data->replicas = replicas;
+
+    for_each_node_state(nid,N_MEMORY)
+    {
+        if (nid == dev_data->backing.nid)
+            continue; //the device backing is this node's copy
+        ret = pcd_backing_init(&replicas[nid].backing,dev_data->backing.type,nid);
+        if (ret)
+            return ret; //pcd_replicas_free cleans up
+        replicas[nid].used = true;
+        if (populate)
+        {
+            ret = pcd_backing_populate(&replicas[nid].backing,pcd_dev_size(dev_data));
+            if (ret)
+                return ret;
+        }
+        WRITE_ONCE(replicas[nid].valid,true);
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+void pcd_replicas_free(struct pcdev_private_data *dev_data)
+{
+    int nid;
+
+    if (!dev_data->replicas)
+        return;
+    for (nid = 0; nid < nr_node_ids; nid++)
+    {
+        if (dev_data->replicas[nid].used)
+            pcd_backing_free(&dev_data->replicas[nid].backing);
+    }
+    kfree(dev_data->replicas);
+    dev_data->replicas = NULL;
+}
+
+/* Stop reading from a replica that missed an update. Its pages stay until unbind, readers may hold them */
+static void pcd_replica_drop(struct pcdev_private_data *dev_data, int nid, int err)
+{
+    WRITE_ONCE(dev_data->replicas[nid].valid,false);
+    dev_warn(dev_data->device,"node %d replica dropped (%d), node reads remote memory now\n",nid,err);
+}
+
+/* Bring the replicas up to date with the device backing over [start,end). Caller holds the range lock */
+void pcd_replicas_sync(struct pcdev_private_data *dev_data, loff_t start, loff_t end)
+{
+    int nid, ret;
+
+    mutex_lock(&dev_data->replica_lock);
+    for (nid = 0; nid < nr_node_ids; nid++)
+    {
+        if (!READ_ONCE(dev_data->replicas[nid].valid))
+            continue;
+        ret = pcd_backing_copy(&dev_data->replicas[nid].backing,&dev_data->backing,start,end);
+        if (ret)
+            pcd_replica_drop(dev_data,nid,ret);
+    }
+    mutex_unlock(&dev_data->replica_lock);
+}
+
+/* Hole punch on every replica. Caller holds the range lock */
+void pcd_replicas_punch(struct pcdev_private_data *dev_data, loff_t start, loff_t end)
+{
+    int nid;
+
+    mutex_lock(&dev_data->replica_lock);
+    for (nid = 0; nid < nr_node_ids; nid++)
+    {
+        if (READ_ONCE(dev_data->replicas[nid].valid))
+            pcd_backing_punch(&dev_data->replicas[nid].backing,start,end);
+    }
+    mutex_unlock(&dev_data->replica_lock);
+}
+
+/* Shrink every replica. Caller holds the range lock from size to the old end */
+void pcd_replicas_truncate(struct pcdev_private_data *dev_data, loff_t size)
+{
+    int nid;
+
+    mutex_lock(&dev_data->replica_lock);
+    for (nid = 0; nid < nr_node_ids; nid++)
+    {
+        if (dev_data->replicas[nid].used)
+            pcd_backing_truncate(&dev_data->replicas[nid].backing,size); //dropped ones too, nobody reads past the end
+    }
+    mutex_unlock(&dev_data->replica_lock);
+}
+
+/* Pages held by all replicas */
+unsigned long pcd_replicas_resident(struct pcdev_private_data *dev_data)
+{
+    unsigned long pages = 0;
+    int nid;
+
+    if (!dev_data->replicas)
+        return 0;
+    for (nid = 0; nid < nr_node_ids; nid++)
+    {
+        if (dev_data->replicas[nid].used)
+            pages += pcd_backing_resident(&dev_data->replicas[nid].backing);
+    }
+    return pages;
+}
@@ -0,0 +1,335 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*
+ * Submission/completion rings: I/O to a pcdev without a system call per request.
+ * PCD_IOC_RING_SETUP on an open pcdev returns a ring fd whose memory (header, SQEs, CQEs, pcd_ioctl.h)
+ * user space maps. SQEs are the batch descriptors (pcd_batch_one), run in order against the pcdev file
+ * the ring was set up on, each completed by a CQE in the same order.
+ * Without PCD_RING_SQPOLL the SQ is consumed by PCD_RING_IOC_ENTER, a batch per call.
+ * With it, a thread per device polls the SQs of all its SQPOLL rings: busy while there is work and for
+ * ring_idle_us after, then it sets PCD_RING_NEED_WAKEUP in every ring and sleeps until a PCD_RING_IOC_ENTER.
+ * Steady state I/O then needs no system call at all.
+ *
+ * Ordering: user space stores sq_tail (or cq_head, a full CQ stalls the SQ), full barrier, loads flags.
+ * The thread stores flags, full barrier, loads sq_tail and cq_head. One of the two sees the other:
+ * either the SQE gets polled or the wakeup gets asked for.
+ */
+
+//************************* FUNCTION DECLARATIONS *****************************//
+
+static int pcd_ring_release(struct inode *inode, struct file *filep);
+static int pcd_ring_mmap(struct file *filep, struct vm_area_struct *vma);
+static long pcd_ring_ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
+
+//************************* GLOBALS *****************************//
+
+static const struct file_operations pcd_ring_fops =
+{
+    .release = pcd_ring_release,
+    .mmap = pcd_ring_mmap,
+    .unlocked_ioctl = pcd_ring_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .owner = THIS_MODULE
+};
+
+//************************* FUNCTIONS *****************************//
+
+void pcd_ring_dev_init(struct pcdev_private_data *dev_data)
+{
+    INIT_LIST_HEAD(&dev_data->rings);
+    mutex_init(&dev_data->ring_lock);
+    init_waitqueue_head(&dev_data->ring_wq);
+    dev_data->ring_thread = NULL;
+    dev_data->ring_idle_us = PCD_RING_IDLE_US;
+}
+
+void pcd_ring_dev_exit(struct pcdev_private_data *dev_data)
+{
+    struct task_struct *thread;
+
+    /* stopped outside ring_lock, the thread takes it */
+    mutex_lock(&dev_data->ring_lock);
+    thread = dev_data->ring_thread;
+    dev_data->ring_thread = NULL;
+    mutex_unlock(&dev_data->ring_lock);
+    if (thread)
+        kthread_stop(thread);
+}
+
+/* SQEs to run and room to complete them */
+static bool pcd_ring_pending(struct pcd_ring *ring)
+{
+    return (ring->sq_head != smp_load_acquire(&ring->hdr->sq_tail)) &&
+           (ring->cq_tail - smp_load_acquire(&ring->hdr->cq_head) < ring->cq_entries);
+}
+
+/*
+ * Run the SQEs written so far and post their CQEs. Stops early when the CQ is full, the rest waits for
+ * user space to reap completions. Caller holds ring->lock and runs in the ring's address space.
+ * Returns the SQEs consumed.
+ */
+static unsigned int pcd_ring_run(struct pcd_ring *ring)
+{
+    struct pcdev_private_data *pcdev_data = ring->dev_data;
+    struct pcd_ring_hdr *hdr = ring->hdr;
+    struct pcd_io_desc desc;
+    struct pcd_sqe *sqe;
+    struct pcd_cqe *cqe;
+    unsigned int done = 0;
+    u32 tail = smp_load_acquire(&hdr->sq_tail); //SQEs before it are fully written
+    u64 user_data;
+    long err = 0;
+
+    if (ring->sq_head == tail)
+        return 0;
+    down_read(&pcdev_data->buf_sem);
+    if (pcdev_data->dead)
+        err = -ENODEV; //removed: the SQEs complete with it, user space still gets its CQEs
+    else if (pcdev_data->pdata.mode != PCD_MODE_ARRAY)
+        err = -ESPIPE;
+    while (ring->sq_head != tail)
+    {
+        if (ring->cq_tail - smp_load_acquire(&hdr->cq_head) >= ring->cq_entries)
+            break;
+        /* one read of every field, user space may be rewriting the slot */
+        sqe = &ring->sqes[ring->sq_head & ring->sq_mask];
+        desc.op = READ_ONCE(sqe->op);
+        desc.reserved = READ_ONCE(sqe->reserved);
+        desc.offset = READ_ONCE(sqe->offset);
+        desc.len = READ_ONCE(sqe->len);
+        desc.buf = READ_ONCE(sqe->buf);
+        user_data = READ_ONCE(sqe->user_data);
+
+        cqe = &ring->cqes[ring->cq_tail & ring->cq_mask];
+        WRITE_ONCE(cqe->user_data,user_data);
+        WRITE_ONCE(cqe->result,err ? err : pcd_batch_one(ring->file,pcdev_data,&desc,false));
+        ring->sq_head++;
+        ring->cq_tail++;
+        smp_store_release(&hdr->cq_tail,ring->cq_tail); //CQE contents before the tail that exposes it
+        smp_store_release(&hdr->sq_head,ring->sq_head); //the SQE slot is free again
+        done++;
+        cond_resched();
+    }
+    up_read(&pcdev_data->buf_sem);
+    return done;
+}
+
+/* Polling thread: one SQPOLL ring, in the address space that set it up. Caller holds dev_data->ring_lock */
+static unsigned int pcd_ring_poll(struct pcd_ring *ring)
+{
+    unsigned int done;
+
+    if (!pcd_ring_pending(ring))
+        return 0;
+    if (!mmget_not_zero(ring->mm))
+        return 0; //its process is exiting, the ring fd goes with it
+    kthread_use_mm(ring->mm);
+    mutex_lock(&ring->lock);
+    done = pcd_ring_run(ring);
+    mutex_unlock(&ring->lock);
+    kthread_unuse_mm(ring->mm);
+    mmput(ring->mm);
+    return done;
+}
+
+/* Set or clear PCD_RING_NEED_WAKEUP in every ring. Returns whether any SQ has work (checked after setting) */
+static bool pcd_ring_need_wakeup(struct pcdev_private_data *dev_data, bool set)
+{
+    struct pcd_ring *ring;
+    bool pending = false;
+
+    mutex_lock(&dev_data->ring_lock);
+    list_for_each_entry(ring,&dev_data->rings,node)
+        WRITE_ONCE(ring->hdr->flags,set ? PCD_RING_NEED_WAKEUP : 0);
+    smp_mb(); //flags before sq_tail, pairs with the barrier of user space between sq_tail and flags
+    list_for_each_entry(ring,&dev_data->rings,node)
+        pending |= pcd_ring_pending(ring);
+    mutex_unlock(&dev_data->ring_lock);
+    return pending;
+}
+
+static int pcd_ring_thread(void *data)
+{
+    struct pcdev_private_data *dev_data = data;
+    unsigned long idle_end = jiffies + usecs_to_jiffies(READ_ONCE(dev_data->ring_idle_us));
+    struct pcd_ring *ring;
+    unsigned int done;
+
+    while (!kthread_should_stop())
+    {
+        done = 0;
+        mutex_lock(&dev_data->ring_lock);
+        list_for_each_entry(ring,&dev_data->rings,node)
+            done += pcd_ring_poll(ring);
+        mutex_unlock(&dev_data->ring_lock);
+        if (done)
+            idle_end = jiffies + usecs_to_jiffies(READ_ONCE(dev_data->ring_idle_us));
+        if (done || time_before(jiffies,idle_end))
+        {
+            cond_resched();
+            continue;
+        }
+
+        /* idle window over: ask for a wakeup, sleep unless something came in meanwhile */
+        if (!pcd_ring_need_wakeup(dev_data,true))
+        {
+            wait_event_interruptible(dev_data->ring_wq,READ_ONCE(dev_data->ring_kick) || kthread_should_stop());
+            WRITE_ONCE(dev_data->ring_kick,false);
+        }
+        pcd_ring_need_wakeup(dev_data,false);
+        idle_end = jiffies + usecs_to_jiffies(READ_ONCE(dev_data->ring_idle_us));
+    }
+    return 0;
+}
+
+static void pcd_ring_kick(struct pcdev_private_data *dev_data)
+{
+    WRITE_ONCE(dev_data->ring_kick,true);
+    wake_up(&dev_data->ring_wq);
+}
+
+static long pcd_ring_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+    struct pcd_ring *ring = filep->private_data;
+    unsigned int done;
+
+    if (cmd != PCD_RING_IOC_ENTER)
+        return -ENOTTY;
+    if (pcd_dev_dead(ring->dev_data))
+        return -ENODEV; //no polling thread anymore either
+    if (ring->sqpoll)
+    {
+        pcd_ring_kick(ring->dev_data);
+        return 0;
+    }
+    /* SQE buffers are addresses of the process that set the ring up */
+    if (current->mm != ring->mm)
+        return -EPERM;
+    mutex_lock(&ring->lock);
+    done = pcd_ring_run(ring);
+    mutex_unlock(&ring->lock);
+    return done;
+}
+
+static int pcd_ring_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+    struct pcd_ring *ring = filep->private_data;
+
+    /* bounds checked against the allocation, VM_DONTEXPAND set */
+    return remap_vmalloc_range(vma,ring->hdr,vma->vm_pgoff);
+}
+
+static void pcd_ring_free(struct pcd_ring *ring)
+{
+    fput(ring->file);
+    mmdrop(ring->mm);
+    vfree(ring->hdr);
+    pcd_dev_put(ring->dev_data);
+    kfree(ring);
+}
+
+static int pcd_ring_release(struct inode *inode, struct file *filep)
+{
+    struct pcd_ring *ring = filep->private_data;
+    struct pcdev_private_data *dev_data = ring->dev_data;
+
+    if (ring->sqpoll)
+    {
+        /* the polling thread walks the list with ring_lock held, it's done with the ring once we have it.
+        After remove the list is still there (our device ref), just no thread walking it */
+        mutex_lock(&dev_data->ring_lock);
+        list_del(&ring->node);
+        mutex_unlock(&dev_data->ring_lock);
+    }
+    pcd_ring_free(ring);
+    return 0;
+}
+
+/* PCD_IOC_RING_SETUP: a ring pair for filep, returns its fd */
+long pcd_ring_setup(struct file *filep, struct pcdev_private_data *pcdev_data, void __user *argp)
+{
+    struct pcd_ring_params params;
+    struct task_struct *thread;
+    struct pcd_ring *ring;
+    size_t size;
+    int fd;
+
+    if (copy_from_user(&params,argp,sizeof(params)))
+        return -EFAULT;
+    if (!params.cq_entries)
+        params.cq_entries = 2 * params.sq_entries;
+    if ((params.flags & ~PCD_RING_SQPOLL) || params.resv || !is_power_of_2(params.sq_entries) ||
+        (params.sq_entries > PCD_RING_MAX_ENTRIES) || !is_power_of_2(params.cq_entries) ||
+        (params.cq_entries < params.sq_entries) || (params.cq_entries > 2 * PCD_RING_MAX_ENTRIES))
+        return -EINVAL;
+    params.sq_off = ALIGN(sizeof(struct pcd_ring_hdr),SMP_CACHE_BYTES);
+    params.cq_off = ALIGN(params.sq_off + params.sq_entries * sizeof(struct pcd_sqe),SMP_CACHE_BYTES);
+    size = PAGE_ALIGN(params.cq_off + params.cq_entries * sizeof(struct pcd_cqe));
+    params.ring_size = size;
+    if (copy_to_user(argp,&params,sizeof(params)))
+        return -EFAULT;
+
+    ring = kzalloc(sizeof(*ring),GFP_KERNEL);
+    if (!ring)
+        return -ENOMEM;
+    ring->hdr = vmalloc_user(size); //zeroed, mappable by remap_vmalloc_range
+    if (!ring->hdr)
+    {
+        kfree(ring);
+        return -ENOMEM;
+    }
+    ring->hdr->sq_entries = params.sq_entries;
+    ring->hdr->cq_entries = params.cq_entries;
+    ring->sqes = (struct pcd_sqe *)((char *)ring->hdr + params.sq_off);
+    ring->cqes = (struct pcd_cqe *)((char *)ring->hdr + params.cq_off);
+    ring->sq_mask = params.sq_entries - 1;
+    ring->cq_mask = params.cq_entries - 1;
+    ring->cq_entries = params.cq_entries;
+    ring->sqpoll = params.flags & PCD_RING_SQPOLL;
+    ring->file = get_file(filep);
+    ring->dev_data = pcdev_data;
+    pcd_dev_get(pcdev_data); //rings may outlive remove (and their pcdev file's release), dropped in pcd_ring_free
+    ring->mm = current->mm;
+    mmgrab(ring->mm);
+    mutex_init(&ring->lock);
+    INIT_LIST_HEAD(&ring->node);
+
+    if (ring->sqpoll)
+    {
+        mutex_lock(&pcdev_data->ring_lock);
+        /* remove marks the device dead before stopping the thread under ring_lock: no thread started after that */
+        if (pcd_dev_dead(pcdev_data))
+        {
+            mutex_unlock(&pcdev_data->ring_lock);
+            pcd_ring_free(ring);
+            return -ENODEV;
+        }
+        if (!pcdev_data->ring_thread)
+        {
+            thread = kthread_run(pcd_ring_thread,pcdev_data,"pcd-ring/%u",MINOR(pcdev_data->dev_num));
+            if (IS_ERR(thread))
+            {
+                mutex_unlock(&pcdev_data->ring_lock);
+                pcd_ring_free(ring);
+                return PTR_ERR(thread);
+            }
+            pcdev_data->ring_thread = thread;
+        }
+        list_add_tail(&ring->node,&pcdev_data->rings);
+        mutex_unlock(&pcdev_data->ring_lock);
+        pcd_ring_kick(pcdev_data); //start polling, the new ring never had NEED_WAKEUP set
+    }
+
+    fd = anon_inode_getfd("[pcd_ring]",&pcd_ring_fops,ring,O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (ring->sqpoll)
+        {
+            mutex_lock(&pcdev_data->ring_lock);
+            list_del(&ring->node);
+            mutex_unlock(&pcdev_data->ring_lock);
+        }
+        pcd_ring_free(ring);
+    }
+    return fd;
+}
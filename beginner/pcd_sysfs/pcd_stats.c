@@ -0,0 +1,164 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+
+/*
+ * Per device I/O statistics.
+ * Counters are per cpu and only touched by the local cpu in the file ops (no locks, no shared cache lines).
+ * Reading a counter sums all cpus. "reset" doesn't touch the per cpu data, it records the current
+ * sums as a baseline that later reads subtract.
+ * Exposed as /sys/class/pcd_class/pcdev-N/stats/
+ */
+
+//************************* FUNCTION DECLARATIONS *****************************//
+
+static ssize_t show_stat(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t store_stats_reset(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+
+//************************* GLOBALS *****************************//
+
+/* device attribute that knows which counter it shows */
+struct pcd_stat_attribute
+{
+    struct device_attribute attr;
+    enum pcd_stat id;
+};
+
+#define PCD_STAT_ATTR(_name,_id) \
+    static struct pcd_stat_attribute pcd_stat_attr_##_name = {__ATTR(_name,S_IRUGO,show_stat,NULL),_id}
+
+PCD_STAT_ATTR(reads,PCD_STAT_READS);
+PCD_STAT_ATTR(writes,PCD_STAT_WRITES);
+PCD_STAT_ATTR(seeks,PCD_STAT_SEEKS);
+PCD_STAT_ATTR(bytes_read,PCD_STAT_BYTES_READ);
+PCD_STAT_ATTR(bytes_written,PCD_STAT_BYTES_WRITTEN);
+PCD_STAT_ATTR(short_transfers,PCD_STAT_SHORT);
+PCD_STAT_ATTR(efault,PCD_STAT_EFAULT);
+PCD_STAT_ATTR(enomem,PCD_STAT_ENOMEM);
+PCD_STAT_ATTR(opens,PCD_STAT_OPENS);
+PCD_STAT_ATTR(huge_faults,PCD_STAT_FAULTS_HUGE);
+PCD_STAT_ATTR(small_faults,PCD_STAT_FAULTS_SMALL);
+static DEVICE_ATTR(reset,S_IWUSR,NULL,store_stats_reset);
+
+static struct attribute *pcd_stats_attrs[] =
+{
+    &pcd_stat_attr_reads.attr.attr,
+    &pcd_stat_attr_writes.attr.attr,
+    &pcd_stat_attr_seeks.attr.attr,
+    &pcd_stat_attr_bytes_read.attr.attr,
+    &pcd_stat_attr_bytes_written.attr.attr,
+    &pcd_stat_attr_short_transfers.attr.attr,
+    &pcd_stat_attr_efault.attr.attr,
+    &pcd_stat_attr_enomem.attr.attr,
+    &pcd_stat_attr_opens.attr.attr,
+    &pcd_stat_attr_huge_faults.attr.attr,
+    &pcd_stat_attr_small_faults.attr.attr,
+    &dev_attr_reset.attr,
+    NULL
+};
+
+const struct attribute_group pcd_stats_group =
+{
+    .name = "stats",
+    .attrs = pcd_stats_attrs
+};
+
+//************************* FUNCTIONS *****************************//
+
+/* Not devm: files still open after remove keep counting (freed with the device data, pcd_dev_put) */
+int pcd_stats_alloc(struct pcdev_private_data *dev_data)
+{
+    int cpu;
+
+    dev_data->stats = alloc_percpu(struct pcd_stats);
+    if (!dev_data->stats)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu)
+        u64_stats_init(&per_cpu_ptr(dev_data->stats,cpu)->syncp);
+    mutex_init(&dev_data->stats_lock);
+    return PCD_DRV_SUCCESS;
+}
+
+void pcd_stats_free(struct pcdev_private_data *dev_data)
+{
+    free_percpu(dev_data->stats);
+    dev_data->stats = NULL;
+}
+
+/* Sum of one counter over all cpus */
+static u64 pcd_stats_sum(struct pcdev_private_data *dev_data, enum pcd_stat id)
+{
+    struct pcd_stats *stats;
+    unsigned int start;
+    u64 sum = 0, val;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        stats = per_cpu_ptr(dev_data->stats,cpu);
+        do {
+            start = u64_stats_fetch_begin(&stats->syncp);
+            val = u64_stats_read(&stats->cnt[id]);
+        } while (u64_stats_fetch_retry(&stats->syncp,start));
+        sum += val;
+    }
+    return sum;
+}
+
+static ssize_t show_stat(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    struct pcd_stat_attribute *stat_attr = container_of(attr,struct pcd_stat_attribute,attr);
+    u64 val;
+
+    mutex_lock(&dev_data->stats_lock);
+    val = pcd_stats_sum(dev_data,stat_attr->id) - dev_data->stats_base[stat_attr->id];
+    mutex_unlock(&dev_data->stats_lock);
+    return sprintf(buf,"%llu\n",val);
+}
+
+static ssize_t store_stats_reset(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    /* get access to the device private data */
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    int id;
+
+    mutex_lock(&dev_data->stats_lock);
+    for (id = 0; id < PCD_STAT_NR; id++)
+        dev_data->stats_base[id] = pcd_stats_sum(dev_data,id);
+    mutex_unlock(&dev_data->stats_lock);
+    return count;
+}
+
+/* All counters at once for io_uring (PCD_URING_CMD_STATS). nowait: -EAGAIN instead of waiting for a reset */
+int pcd_stats_snapshot(struct pcdev_private_data *dev_data, struct pcd_stats_snap *snap, bool nowait)
+{
+    u64 val[PCD_STAT_NR];
+    int id;
+
+    if (nowait)
+    {
+        if (!mutex_trylock(&dev_data->stats_lock))
+            return -EAGAIN;
+    }
+    else
+        mutex_lock(&dev_data->stats_lock);
+    for (id = 0; id < PCD_STAT_NR; id++)
+        val[id] = pcd_stats_sum(dev_data,id) - dev_data->stats_base[id];
+    mutex_unlock(&dev_data->stats_lock);
+
+    memset(snap,0,sizeof(*snap));
+    snap->reads = val[PCD_STAT_READS];
+    snap->writes = val[PCD_STAT_WRITES];
+    snap->seeks = val[PCD_STAT_SEEKS];
+    snap->bytes_read = val[PCD_STAT_BYTES_READ];
+    snap->bytes_written = val[PCD_STAT_BYTES_WRITTEN];
+    snap->short_transfers = val[PCD_STAT_SHORT];
+    snap->efault = val[PCD_STAT_EFAULT];
+    snap->enomem = val[PCD_STAT_ENOMEM];
+    snap->opens = val[PCD_STAT_OPENS];
+    snap->huge_faults = val[PCD_STAT_FAULTS_HUGE];
+    snap->small_faults = val[PCD_STAT_FAULTS_SMALL];
+    snap->size = pcd_dev_size(dev_data);
+    snap->resident_bytes = (u64)(pcd_backing_resident(&dev_data->backing) + pcd_replicas_resident(dev_data)) << PAGE_SHIFT;
+    return PCD_DRV_SUCCESS;
+}
@@ -0,0 +1,182 @@
+/*
+ * pcd_stress: concurrency stress for one pcdev.
+ *
+ * read mode : 1..N threads (one per cpu) pread the same device. Readers only share buf_sem,
+ *             so throughput should grow linearly with the thread count.
+ * write mode: every thread pwrites its own slice of the device. Byte range locks don't
+ *             overlap, so writers should scale the same way.
+ *
+ * usage: pcd_stress <device> <read|write> [threads] [block size] [seconds]
+ *        pcd_stress /dev/pcdev-0 read 4 4096 5
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+struct worker
+{
+	pthread_t thread;
+	int cpu;
+	int fd;
+	int write_mode;
+	off_t start;	/* slice of the device this worker walks through */
+	off_t len;
+	size_t bs;
+	unsigned long long ops;
+	unsigned long long errors;
+};
+
+static volatile int stop;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char *buf;
+	off_t off = 0;
+	ssize_t ret;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu,&set);
+	pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+
+	buf = malloc(w->bs);
+	if(!buf)
+		return NULL;
+	memset(buf,w->cpu,w->bs);
+
+	while(!stop){
+		if(off + (off_t)w->bs > w->len)
+			off = 0;
+		if(w->write_mode)
+			ret = pwrite(w->fd,buf,w->bs,w->start + off);
+		else
+			ret = pread(w->fd,buf,w->bs,w->start + off);
+		if(ret < 0)
+			w->errors++;
+		else
+			w->ops++;
+		off += w->bs;
+	}
+	free(buf);
+	return NULL;
+}
+
+/* run nthreads workers for secs seconds, returns ops/sec */
+static double run(const char *path, int write_mode, int nthreads, size_t bs, int secs, off_t dev_size)
+{
+	struct worker *workers;
+	unsigned long long ops = 0, errors = 0;
+	double t0, t1;
+	off_t slice;
+	int i;
+
+	workers = calloc(nthreads,sizeof(*workers));
+	if(!workers)
+		return 0;
+
+	/* readers all walk the whole device, writers get disjoint slices */
+	slice = write_mode ? dev_size / nthreads : dev_size;
+	if(slice < (off_t)bs){
+		printf("device too small for %d writers of %zu bytes\n",nthreads,bs);
+		free(workers);
+		return 0;
+	}
+
+	stop = 0;
+	for(i = 0; i < nthreads; i++){
+		workers[i].cpu = i;
+		workers[i].write_mode = write_mode;
+		workers[i].start = write_mode ? slice * i : 0;
+		workers[i].len = slice;
+		workers[i].bs = bs;
+		/* one open file per thread, like independent processes would do */
+		workers[i].fd = open(path,write_mode ? O_WRONLY : O_RDONLY);
+		if(workers[i].fd < 0){
+			perror("open");
+			exit(1);
+		}
+	}
+	t0 = now();
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&workers[i].thread,NULL,worker_fn,&workers[i]);
+	sleep(secs);
+	stop = 1;
+	for(i = 0; i < nthreads; i++){
+		pthread_join(workers[i].thread,NULL);
+		ops += workers[i].ops;
+		errors += workers[i].errors;
+		close(workers[i].fd);
+	}
+	t1 = now();
+	free(workers);
+
+	if(errors)
+		printf("  %llu errors\n",errors);
+	return ops / (t1 - t0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path;
+	int write_mode;
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t bs = 4096;
+	int secs = 3;
+	off_t dev_size;
+	double base = 0, rate;
+	int fd, n;
+
+	if(argc < 3){
+		printf("Wrong usage\n");
+		printf("Correct usage: <device> <read|write> [threads] [block size] [seconds]\n");
+		return 0;
+	}
+	path = argv[1];
+	write_mode = !strcmp(argv[2],"write");
+	if(argc > 3)
+		max_threads = atoi(argv[3]);
+	if(argc > 4)
+		bs = atoi(argv[4]);
+	if(argc > 5)
+		secs = atoi(argv[5]);
+
+	fd = open(path,write_mode ? O_WRONLY : O_RDONLY);
+	if(fd < 0){
+		/*perror decodes user space errno variable and prints cause of failure*/
+		perror("open");
+		return fd;
+	}
+	dev_size = lseek(fd,0,SEEK_END);
+	close(fd);
+	if(dev_size < (off_t)bs){
+		printf("device smaller than block size\n");
+		return 1;
+	}
+
+	printf("%s %s, block %zu bytes, %d s per step, device %lld bytes\n",path,write_mode ? "write" : "read",bs,secs,(long long)dev_size);
+	printf("threads      ops/s    speedup\n");
+	for(n = 1; n <= max_threads; n++){
+		rate = run(path,write_mode,n,bs,secs,dev_size);
+		if(n == 1)
+			base = rate;
+		printf("%7d %10.0f %9.2fx\n",n,rate,base ? rate / base : 0);
+	}
+	return 0;
+}
@@ -1,114 +1,953 @@
 #include "pcd_platform_driver_dt_sysfs.h"
 
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
+
 //************************* FUNCTIONS *****************************//
 
 loff_t pcd_lseek(struct file *filep, loff_t offset, int whence)
 {   
     struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->pdata.size;  
+    loff_t max_size = pcd_dev_size(pcdev_data);
     loff_t temp=0;
-    pr_info("lseek requested\n");
-    pr_info("Current file position: %lld\n",filep->f_pos);
+    loff_t ret;
+    u64 t0 = local_clock();
+    if (pcd_dev_dead(pcdev_data))
+    {
+        ret = -ENODEV;
+        goto out;
+    }
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_LOG)
+    {
+        ret = pcd_log_lseek(filep,offset,whence); //position is a record number
+        goto out;
+    }
+    if (READ_ONCE(pcdev_data->pdata.mode) != PCD_MODE_ARRAY)
+    {
+        ret = -ESPIPE; //a pipe or a queue has no position
+        goto out;
+    }
     switch(whence)
     {
         case SEEK_SET:
             if((offset>max_size) || (offset<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = offset;
             break;
         case SEEK_CUR:
-            temp = filep->f_pos + offset;
-            if ((temp>max_size) || (temp<0))
+            /* f_pos may be past the end after a shrink, count from the end then */
+            if (check_add_overflow(min(filep->f_pos,max_size),offset,&temp) || (temp>max_size) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
             }
             filep->f_pos = temp;
             break;
         case SEEK_END:
-            temp = max_size + offset;
-            if ((temp>max_size) || (temp<0))
+            if (check_add_overflow(max_size,offset,&temp) || (temp>max_size) || (temp<0))
             {
-                return -EINVAL;
+                ret = -EINVAL;
+                goto out;
+            }
+            filep->f_pos = temp;
+            break;
+        case SEEK_DATA:
+        case SEEK_HOLE:
+            /* skip never written ranges (sparse backing) */
+            temp = pcd_backing_seek_data_hole(&pcdev_data->backing,offset,max_size,whence);
+            if (temp < 0)
+            {
+                ret = temp;
+                goto out;
             }
             filep->f_pos = temp;
             break;
         default:
-            return -EINVAL; //invalid arg received for whence
+            ret = -EINVAL; //invalid arg received for whence
+            goto out;
     }
 
-    pr_info("Updated file position: %lld\n",filep->f_pos);
-
     /* return update file position */
-    return filep->f_pos;
+    ret = filep->f_pos;
+out:
+    trace_pcd_lseek(MINOR(pcdev_data->dev_num),offset,whence,ret);
+    pcd_stats_inc(pcdev_data,PCD_STAT_SEEKS);
+    pcd_lat_record(pcdev_data,PCD_LAT_LSEEK,0,t0);
+    return ret;
 }
 
-ssize_t pcd_read(struct file *filep, char __user *buff, size_t count, loff_t *f_pos)
+/* Take buf_sem shared. Readers and writers never exclude each other here, only a resize does. -ENODEV once removed */
+static int pcd_buf_read_lock(struct pcdev_private_data *pcdev_data, bool nowait)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->pdata.size;
-    pr_info("read requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
+    if (nowait)
+    {
+        if (!down_read_trylock(&pcdev_data->buf_sem))
+            return -EAGAIN;
+    }
+    else
+        down_read(&pcdev_data->buf_sem);
+    if (pcdev_data->dead)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -ENODEV;
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+/* pcd_buf_read_lock and check the device is (still) in array mode: a mode switch may have come after the dispatch */
+static int pcd_array_lock(struct pcdev_private_data *pcdev_data, bool nowait)
+{
+    int ret;
+
+    if (ret = pcd_buf_read_lock(pcdev_data,nowait))
+        return ret;
+    if (pcdev_data->pdata.mode != PCD_MODE_ARRAY)
+    {
+        up_read(&pcdev_data->buf_sem);
+        return -EIO; //the buffer holds a ring or a queue now
+    }
+    return PCD_DRV_SUCCESS;
+}
+
+/*
+ * Array mode read of iov_iter_count(to) bytes at pos, accounted as one read. Caller holds buf_sem shared.
+ * Returns bytes read (short at the end of the device or on a partial fault)
+ */
+static ssize_t pcd_array_read(struct pcdev_private_data *pcdev_data, loff_t pos, struct iov_iter *to)
+{
+    loff_t max_size = pcd_dev_size(pcdev_data); //a shrink racing with us only turns the tail into zeroes
+    size_t count = iov_iter_count(to);
+    size_t requested = count;
+    ssize_t ret;
+
+    /*Adjust the count. pread may start anywhere, past the end reads nothing*/
+    if (pos >= max_size)
+        count = 0;
+    else if (count > max_size - pos)
+        count = max_size - pos;
+
+    /*copy to user page by page. All segments of a readv/preadv2 are served in this one pass*/
+    ret = pcd_backing_to_iter(pcd_read_backing(pcdev_data),pos,count,to);
+    if (!ret && count)
+        ret = -EFAULT;
+    trace_pcd_read(MINOR(pcdev_data->dev_num),pos,count,ret);
+    pcd_stats_rw(pcdev_data,false,requested,ret);
+    return ret;
+}
+
+/*
+ * Array mode write of iov_iter_count(from) bytes at pos, accounted as one write. Caller holds buf_sem shared.
+ * Returns bytes written (short at the end of the device or on a partial fault)
+ */
+static ssize_t pcd_array_write(struct pcdev_private_data *pcdev_data, loff_t pos, struct iov_iter *from, bool nowait)
+{
+    struct pcd_range range;
+    loff_t max_size = pcd_dev_size(pcdev_data);
+    size_t count = iov_iter_count(from);
+    size_t requested = count;
+    size_t done = 0;
+    ssize_t ret;
 
     /*Adjust the count*/
-    if ((*f_pos+count) > max_size)
+    if (pos >= max_size)
+        count = 0;
+    else if (count > max_size - pos)
+        count = max_size - pos;
+
+    if (!count)
+    {
+        /* No space left on the device */
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (nowait && pcdev_data->replicas)
     {
-        count = max_size - *f_pos;
+        ret = -EAGAIN; //the replica sync takes a mutex and allocates
+        goto out;
     }
 
-    /*copy to user*/
-    if (copy_to_user(buff,pcdev_data->buffer+(*f_pos),count))
+    /*
+     * The source may be an mmap of a hole of this (or another) pcdev, whose fault takes the range lock
+     * of that page too: fault it in first, copy with page faults off under the lock. A short copy drops
+     * the lock, faults the rest in and goes again.
+     * nowait does neither the fault in nor page allocations, both may sleep: it stops at the first short
+     * copy, -EAGAIN if nothing was written.
+     */
+    while (done < count)
     {
-        return -EFAULT;
+        if (!nowait && !pcd_fault_in_readable(from,count - done))
+        {
+            ret = -EFAULT;
+            break;
+        }
+        /* writers on non overlapping regions go in parallel */
+        ret = pcd_range_lock(&pcdev_data->wr_ranges,&range,pos + done,pos + count,nowait);
+        if (ret)
+            break;
+
+        /* a shrink drops pages under the range lock too: with ours held the size can't move below pos+count unnoticed */
+        max_size = pcd_dev_size(pcdev_data);
+        if (pos + done >= max_size)
+        {
+            pcd_range_unlock(&pcdev_data->wr_ranges,&range);
+            ret = -ENOMEM;
+            break;
+        }
+        count = min_t(loff_t,count,max_size - pos);
+
+        /*copy from user page by page. All segments of a writev/pwritev2 are gathered in this one pass*/
+        pagefault_disable();
+        ret = pcd_backing_from_iter(&pcdev_data->backing,pos + done,count - done,from,nowait);
+        pagefault_enable();
+        if (pcdev_data->replicas && (ret > 0))
+            pcd_replicas_sync(pcdev_data,pos + done,pos + done + ret);
+        pcd_range_unlock(&pcdev_data->wr_ranges,&range);
+        if (ret == -EFAULT)
+            ret = 0; //shmem: the source went away again, fault it back in
+        if (ret < 0)
+            break; //-ENOMEM: no page could be allocated, or -EAGAIN
+        done += ret;
+        if (nowait && (done < count))
+        {
+            ret = -EAGAIN; //source not resident or a page to allocate
+            break;
+        }
     }
+    if (done)
+        ret = done;
+out:
+    trace_pcd_write(MINOR(pcdev_data->dev_num),pos,count,ret);
+    pcd_stats_rw(pcdev_data,true,requested,ret);
+    return ret;
+}
+
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    size_t requested = iov_iter_count(to);
+    ssize_t ret;
+    u64 t0 = local_clock();
+
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_FIFO)
+    {
+        ret = pcd_fifo_read_iter(iocb,to); //blocking time included, that's the latency a pipe user sees
+        pcd_lat_record(pcdev_data,PCD_LAT_READ,requested,t0);
+        return ret;
+    }
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_MSG)
+    {
+        ret = pcd_msg_read_iter(iocb,to); //one whole record
+        pcd_lat_record(pcdev_data,PCD_LAT_READ,requested,t0);
+        return ret;
+    }
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_LOG)
+    {
+        ret = pcd_log_read_iter(iocb,to); //the whole record at this file's cursor
+        pcd_lat_record(pcdev_data,PCD_LAT_READ,requested,t0);
+        return ret;
+    }
+
+    ret = pcd_array_lock(pcdev_data,iocb->ki_flags & IOCB_NOWAIT);
+    if (ret)
+    {
+        trace_pcd_read(MINOR(pcdev_data->dev_num),iocb->ki_pos,requested,ret);
+        pcd_stats_rw(pcdev_data,false,requested,ret);
+        goto out;
+    }
+    ret = pcd_array_read(pcdev_data,iocb->ki_pos,to);
+    up_read(&pcdev_data->buf_sem);
 
     /*update current file position*/
-    *f_pos += count;
-    pr_info("Number of bytes successfully read: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
+    if (ret > 0)
+        iocb->ki_pos += ret;
 
-    /* return number of bytes successfully read */
-    return count;
+    /* return number of bytes successfully read (short read on a partial fault) */
+out:
+    pcd_lat_record(pcdev_data,PCD_LAT_READ,requested,t0);
+    return ret;
 }
 
-ssize_t pcd_write(struct file *filep, const char __user *buff, size_t count, loff_t *f_pos)
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(iocb->ki_filp->private_data);
+    bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+    size_t requested = iov_iter_count(from);
+    ssize_t ret;
+    u64 t0 = local_clock();
+
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_FIFO)
+    {
+        ret = pcd_fifo_write_iter(iocb,from); //blocking time included, that's the latency a pipe user sees
+        pcd_lat_record(pcdev_data,PCD_LAT_WRITE,requested,t0);
+        return ret;
+    }
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_MSG)
+    {
+        ret = pcd_msg_write_iter(iocb,from); //the whole write is one record
+        pcd_lat_record(pcdev_data,PCD_LAT_WRITE,requested,t0);
+        return ret;
+    }
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_LOG)
+    {
+        ret = pcd_log_write_iter(iocb,from); //appended, whatever the file position
+        pcd_lat_record(pcdev_data,PCD_LAT_WRITE,requested,t0);
+        return ret;
+    }
+
+    ret = pcd_array_lock(pcdev_data,nowait);
+    if (ret)
+    {
+        trace_pcd_write(MINOR(pcdev_data->dev_num),iocb->ki_pos,requested,ret);
+        pcd_stats_rw(pcdev_data,true,requested,ret);
+        goto out;
+    }
+    ret = pcd_array_write(pcdev_data,iocb->ki_pos,from,nowait);
+    up_read(&pcdev_data->buf_sem);
+
+    /*update current file position*/
+    if (ret > 0)
+        iocb->ki_pos += ret;
+
+    /* return number of bytes successfully written (short write on a partial fault) */
+out:
+    pcd_lat_record(pcdev_data,PCD_LAT_WRITE,requested,t0);
+    return ret;
+}
+
+/* Pipe buffers referencing device pages: a ref each, never stolen or merged into (the page stays the device's) */
+static const struct pipe_buf_operations pcd_pipe_buf_ops =
+{
+    .release = generic_pipe_buf_release,
+    .get = generic_pipe_buf_get
+};
+
+/* Holes go in as the shared zero page, which isn't refcounted */
+static void pcd_zero_buf_release(struct pipe_inode_info *pipe, struct pipe_buffer *buf)
+{
+}
+
+static bool pcd_zero_buf_get(struct pipe_inode_info *pipe, struct pipe_buffer *buf)
+{
+    return true;
+}
+
+static const struct pipe_buf_operations pcd_zero_pipe_buf_ops =
+{
+    .release = pcd_zero_buf_release,
+    .get = pcd_zero_buf_get
+};
+
+/*
+ * splice()/sendfile() out of the device without copying: the pipe gets references to the device pages.
+ * Like splicing from the page cache, the consumer sees the page as it is when it reads the pipe,
+ * a write() in between shows through. FIFO/message mode consume what they read, that is read_iter's job (one copy).
+ */
+ssize_t pcd_splice_read(struct file *filep, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags)
 {
     struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
-    int max_size = pcdev_data->pdata.size;  
-    pr_info("write requested for %zu bytes\n",count);
-    pr_info("Current file position: %lld\n",*f_pos);
+    struct pcd_backing *backing;
+    struct pipe_buffer buf;
+    struct page *page;
+    loff_t start = *ppos, pos = *ppos;
+    loff_t max_size;
+    size_t requested = len;
+    size_t chunk;
+    ssize_t ret, added;
+    u64 t0 = local_clock();
 
-    /*Adjust the count*/
-    if ((*f_pos+count) > max_size)
+    if (READ_ONCE(pcdev_data->pdata.mode) != PCD_MODE_ARRAY)
     {
-        count = max_size - *f_pos;
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 5, 0 ) ) // Hack to support newer kernel versions (host linux is newer currently)
+        return copy_splice_read(filep,ppos,pipe,len,flags);
+    #else
+        return generic_file_splice_read(filep,ppos,pipe,len,flags);
+    #endif
     }
 
-    if (!count)
+    ret = pcd_array_lock(pcdev_data,flags & SPLICE_F_NONBLOCK);
+    if (ret)
+        goto out;
+    max_size = pcd_dev_size(pcdev_data);
+    if (pos >= max_size)
+        len = 0;
+    else if (len > max_size - pos)
+        len = max_size - pos;
+
+    backing = pcd_read_backing(pcdev_data);
+    if (backing->shmem)
+    {
+        /* tmpfs splices its own pages the same way */
+        ret = len ? backing->shmem->f_op->splice_read(backing->shmem,&pos,pipe,len,flags) : 0;
+        up_read(&pcdev_data->buf_sem);
+        goto done;
+    }
+
+    /* as many pages as the pipe takes, the caller holds the pipe lock */
+    while (len && !pipe_full(pipe->head,pipe->tail,pipe->max_usage))
     {
-        pr_err("No space left on the device\n");
-        return -ENOMEM;
+        chunk = min_t(size_t,PAGE_SIZE - offset_in_page(pos),len);
+        memset(&buf,0,sizeof(buf)); //no PIPE_BUF_FLAG_CAN_MERGE: pipe writes must never land in a device page
+        page = pcd_backing_get_page(backing,pos >> PAGE_SHIFT,false);
+        buf.page = page ? page : ZERO_PAGE(0);
+        buf.ops = page ? &pcd_pipe_buf_ops : &pcd_zero_pipe_buf_ops;
+        buf.offset = offset_in_page(pos);
+        buf.len = chunk;
+        added = add_to_pipe(pipe,&buf); //releases the buffer on failure
+        if (added < 0)
+        {
+            if (!ret)
+                ret = added;
+            break;
+        }
+        pos += added;
+        len -= added;
+        ret += added;
     }
+    up_read(&pcdev_data->buf_sem);
+done:
+    if (ret > 0)
+        *ppos = pos;
+out:
+    trace_pcd_read(MINOR(pcdev_data->dev_num),start,requested,ret);
+    pcd_stats_rw(pcdev_data,false,requested,ret);
+    pcd_lat_record(pcdev_data,PCD_LAT_READ,requested,t0);
+    return ret;
+}
+
+/*
+ * Will the core map the page with one PMD: part of a PMD sized folio, nothing mapped in its PMD range yet
+ * and the range inside the vma with file offsets lined up (finish_fault maps the whole folio then)
+ */
+static bool pcd_fault_is_huge(struct vm_fault *vmf, struct page *page)
+{
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+    struct vm_area_struct *vma = vmf->vma;
+    unsigned long haddr = vmf->address & HPAGE_PMD_MASK;
+
+    if (!PageTransCompound(page) || (compound_order(compound_head(page)) != HPAGE_PMD_ORDER) || !pmd_none(*vmf->pmd))
+        return false;
+    if (!IS_ALIGNED((vma->vm_start >> PAGE_SHIFT) - vma->vm_pgoff,HPAGE_PMD_NR))
+        return false;
+    return (haddr >= vma->vm_start) && (haddr + HPAGE_PMD_SIZE <= vma->vm_end);
+#else
+    return false;
+#endif
+}
+
+static vm_fault_t pcd_vm_fault(struct vm_fault *vmf)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(vmf->vma->vm_private_data);
+    loff_t start = (loff_t)vmf->pgoff << PAGE_SHIFT;
+    /* local replica: shared mappings of replicated devices are read only (pcd_mmap), stores can't bypass the replicas */
+    struct pcd_backing *backing = pcd_read_backing(pcdev_data);
+    struct pcd_range range;
+    struct page *page;
+    vm_fault_t ret;
+
+    /* like a truncated file, past the end is SIGBUS. So is a removed device or one that left array mode (mappings zapped) */
+    if (pcd_dev_left_mode(pcdev_data,PCD_MODE_ARRAY) || (start >= pcd_dev_size(pcdev_data)))
+        return VM_FAULT_SIGBUS;
+retry:
+    page = pcd_backing_get_page(backing,vmf->pgoff,false);
+    if (IS_ERR(page))
+        return VM_FAULT_OOM; //shmem swap in
+    if (page && pcd_backing_page_private(backing,vmf->pgoff,page))
+        goto out;
+    if (page)
+        put_page(page); //shared copy on write (pcd_backing_clone), never mapped: get a private one
 
-    /*copy to user*/
-    if (copy_from_user(pcdev_data->buffer+(*f_pos),buff,count)) 
     /*
-    * Found a bug above during development. 
-    * Used &pcdev_data->buffer instead of direct dereference for pointer. 
-    * This caused mem overwrite. Kernel memory is so insecure. This caused segmentation fault big crash (memory leak).
-    */
+     * Holes get their page now, even on a read fault: a shared zero page wouldn't see later write()s.
+     * Allocate like a writer, under the range lock with the size rechecked, or a racing shrink
+     * could miss the new page and leave it past the end.
+     */
+    if (pcd_range_lock(&pcdev_data->wr_ranges,&range,start,start + PAGE_SIZE,false))
+        return VM_FAULT_NOPAGE; //fatal signal: nothing mapped, the task is going away
+    ret = 0;
+    if (start >= pcd_dev_size(pcdev_data))
+        ret = VM_FAULT_SIGBUS;
+    else
+    {
+        page = pcd_backing_get_page(backing,vmf->pgoff,true);
+        if (IS_ERR(page))
+            ret = VM_FAULT_OOM;
+    }
+    pcd_range_unlock(&pcdev_data->wr_ranges,&range);
+    if (ret)
+        return ret;
+out:
+    /* mapped locked: a copy range can't share the page while it's being mapped, and does none once it is */
+    lock_page(page);
+    if (!pcd_backing_page_private(backing,vmf->pgoff,page))
     {
+        unlock_page(page);
+        put_page(page);
+        goto retry;
+    }
+    /* removed or mode switched meanwhile: don't map behind the zap. One that still slips in maps a page the vma keeps a ref on (and a device ref) */
+    if (pcd_dev_left_mode(pcdev_data,PCD_MODE_ARRAY))
+    {
+        unlock_page(page);
+        put_page(page);
+        return VM_FAULT_SIGBUS;
+    }
+    pcd_stats_inc(pcdev_data,pcd_fault_is_huge(vmf,page) ? PCD_STAT_FAULTS_HUGE : PCD_STAT_FAULTS_SMALL);
+    vmf->page = page; //returned with a ref. A huge folio subpage gets the whole folio mapped by one PMD
+    return VM_FAULT_LOCKED;
+}
+
+/* Every vma (split and fork copies too) holds a device ref, faults may come after remove */
+static void pcd_vm_open(struct vm_area_struct *vma)
+{
+    pcd_dev_get((struct pcdev_private_data*)(vma->vm_private_data));
+}
+
+static void pcd_vm_close(struct vm_area_struct *vma)
+{
+    pcd_dev_put((struct pcdev_private_data*)(vma->vm_private_data));
+}
+
+static const struct vm_operations_struct pcd_vm_ops =
+{
+    .open = pcd_vm_open,
+    .close = pcd_vm_close,
+    .fault = pcd_vm_fault,
+};
+
+int pcd_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    u64 nr_pages = DIV_ROUND_UP_ULL(pcd_dev_size(pcdev_data),PAGE_SIZE);
+    int perm = pcdev_data->pdata.perm;
+
+    if (pcd_dev_dead(pcdev_data))
+        return -ENODEV;
+    /* ring/queue contents don't sit at fixed offsets, nothing sensible to map */
+    if (READ_ONCE(pcdev_data->pdata.mode) != PCD_MODE_ARRAY)
+        return -EINVAL;
+
+    /* mapping must stay inside the device buffer. Counted in pages, byte offsets overflow on 32 bit */
+    if ((vma->vm_pgoff >= nr_pages) || (vma_pages(vma) > nr_pages - vma->vm_pgoff))
+        return -EINVAL;
+
+    /* device permission decides which PROT flags a shared mapping may have (now and after mprotect) */
+    if (!(perm & DEV_DRV_PERM_RDONLY))
+    {
+        if (vma->vm_flags & (VM_READ|VM_EXEC))
+            return -EACCES;
+        pcd_vm_flags_mod(vma,0,VM_MAYREAD|VM_MAYEXEC);
+    }
+    /* replicated: stores through a shared mapping would only reach one copy */
+    if ((!(perm & DEV_DRV_PERM_WRONLY) || pcdev_data->replicas) && (vma->vm_flags & VM_SHARED))
+    {
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+        pcd_vm_flags_mod(vma,0,VM_MAYWRITE);
+    }
+
+    /* buffer can't grow under a mapping, no point in dumping it either */
+    pcd_vm_flags_mod(vma,VM_DONTEXPAND|VM_DONTDUMP,0);
+    vma->vm_ops = &pcd_vm_ops;
+    vma->vm_private_data = pcdev_data;
+    pcd_dev_get(pcdev_data); //the core doesn't call .open for the first vma, dropped by .close
+    return 0;
+}
+
+#if ( LINUX_VERSION_CODE < KERNEL_VERSION( 5, 18, 0 ) )
+/*
+ * Mapping address with the same offset in a PMD as the file offset, so the huge backing's folios can be
+ * mapped by one PMD each. What thp_get_unmapped_area does for every file from 5.18 on (only DAX before):
+ * ask for PMD_SIZE more and move the start up to the matching offset. A hint or MAP_FIXED is left alone.
+ */
+unsigned long pcd_get_unmapped_area(struct file *filep, unsigned long addr, unsigned long len, unsigned long pgoff, unsigned long flags)
+{
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+    loff_t off = (loff_t)pgoff << PAGE_SHIFT;
+    unsigned long len_pad = len + PMD_SIZE;
+    unsigned long ret;
+
+    if (!addr && !(flags & MAP_FIXED) && (len >= PMD_SIZE) && (len_pad > len) && (off + len_pad > off))
+    {
+        ret = current->mm->get_unmapped_area(filep,0,len_pad,pgoff,flags);
+        if (!IS_ERR_VALUE(ret))
+            return ret + ((off - ret) & (PMD_SIZE - 1));
+    }
+#endif
+    return current->mm->get_unmapped_area(filep,addr,len,pgoff,flags);
+}
+#endif
+
+/* Zap the mappings of the whole pages in [start,end), the ones a punch releases (partial pages are zeroed in place) */
+static void pcd_punch_unmap(struct pcdev_private_data *pcdev_data, loff_t start, loff_t end)
+{
+    loff_t hole_start = round_up(start,PAGE_SIZE);
+    loff_t hole_end = round_down(end,PAGE_SIZE);
+
+    if (hole_start < hole_end)
+        pcd_dev_unmap(pcdev_data,hole_start,hole_end - hole_start,false);
+}
+
+/* Release the pages of [offset,offset+len), the range reads as zeroes afterwards */
+static long pcd_punch_hole(struct file *filep, struct pcdev_private_data *pcdev_data, void __user *argp)
+{
+    struct pcd_range_arg arg;
+    struct pcd_range range;
+    loff_t size, end;
+    long ret;
+
+    if (!(filep->f_mode & FMODE_WRITE))
+        return -EBADF;
+    if (copy_from_user(&arg,argp,sizeof(arg)))
         return -EFAULT;
+    if ((arg.offset > LLONG_MAX) || (arg.len == 0) || (arg.len > LLONG_MAX - arg.offset))
+        return -EINVAL;
+
+    if (ret = pcd_buf_read_lock(pcdev_data,false))
+        return ret;
+    if (pcdev_data->pdata.mode != PCD_MODE_ARRAY)
+    {
+        ret = -ESPIPE;
+        goto unlock;
     }
+    size = pcd_dev_size(pcdev_data);
+    if (arg.offset >= size)
+    {
+        ret = PCD_DRV_SUCCESS; //nothing there, like punching past EOF
+        goto unlock;
+    }
+    end = min_t(u64,arg.offset + arg.len,size);
 
-    /*update current file position*/
-    *f_pos += count;
-    pr_info("Number of bytes successfully written: %zu\n",count);
-    pr_info("Updated file position: %lld\n",*f_pos);
+    /* writers to the range wait, everything else keeps going */
+    ret = pcd_range_lock(&pcdev_data->wr_ranges,&range,arg.offset,end,false);
+    if (ret)
+        goto unlock;
+    /* like a shmem punch: the whole pages released leave the mappings (private copies stay). Zapped again after,
+    a fault of a present page doesn't take the range lock and may map one in between */
+    pcd_punch_unmap(pcdev_data,arg.offset,end);
+    pcd_backing_punch(&pcdev_data->backing,arg.offset,end);
+    if (pcdev_data->replicas)
+        pcd_replicas_punch(pcdev_data,arg.offset,end);
+    pcd_punch_unmap(pcdev_data,arg.offset,end);
+    pcd_range_unlock(&pcdev_data->wr_ranges,&range);
+unlock:
+    up_read(&pcdev_data->buf_sem);
+    return ret;
+}
+
+/*
+ * Take the range locks of a copy in a fixed order (lower device, then lower offset first), copies running
+ * the other way can't deadlock. Within one device the ranges may share a page, rb then covers both and ra is unused
+ */
+static int pcd_copy_lock(struct pcdev_private_data *a, struct pcd_range *ra, loff_t a_start, loff_t a_end,
+                         struct pcdev_private_data *b, struct pcd_range *rb, loff_t b_start, loff_t b_end)
+{
+    int ret;
+
+    if (a == b)
+        return pcd_range_lock(&b->wr_ranges,rb,min(a_start,b_start),max(a_end,b_end),false);
+    if (a > b)
+        return pcd_copy_lock(b,rb,b_start,b_end,a,ra,a_start,a_end);
+    if (ret = pcd_range_lock(&a->wr_ranges,ra,a_start,a_end,false))
+        return ret;
+    if (ret = pcd_range_lock(&b->wr_ranges,rb,b_start,b_end,false))
+        pcd_range_unlock(&a->wr_ranges,ra);
+    return ret;
+}
+
+/*
+ * Copy [src_offset,src_offset+len) of the pcdev open as src_fd to dst_offset of this one, inside the kernel.
+ * PCD_COPY_SHARE: share whole pages copy on write instead of copying them where the backings allow.
+ * Returns bytes copied, short at the end of either device, like copy_file_range().
+ */
+static long pcd_copy_range(struct file *filep, struct pcdev_private_data *dst_data, void __user *argp)
+{
+    struct pcdev_private_data *src_data;
+    struct pcd_range src_range, dst_range;
+    struct pcd_copy_arg arg;
+    struct file *src_file;
+    loff_t len;
+    ssize_t ret;
+    u64 t0 = local_clock();
+
+    if (!(filep->f_mode & FMODE_WRITE))
+        return -EBADF;
+    if (copy_from_user(&arg,argp,sizeof(arg)))
+        return -EFAULT;
+    if ((arg.flags & ~PCD_COPY_SHARE) || (arg.src_offset > LLONG_MAX) || (arg.dst_offset > LLONG_MAX))
+        return -EINVAL;
+    len = min_t(u64,arg.len,MAX_RW_COUNT);
+
+    src_file = fget(arg.src_fd);
+    if (!src_file)
+        return -EBADF;
+    if (src_file->f_op != &pcd_fops)
+    {
+        ret = -EXDEV; //not a pcdev
+        goto put;
+    }
+    if (!(src_file->f_mode & FMODE_READ))
+    {
+        ret = -EBADF;
+        goto put;
+    }
+    src_data = (struct pcdev_private_data*)(src_file->private_data);
+
+    /* buf_sem of both in device order, like the range locks */
+    down_read((src_data < dst_data) ? &src_data->buf_sem : &dst_data->buf_sem);
+    if (src_data != dst_data)
+        down_read((src_data < dst_data) ? &dst_data->buf_sem : &src_data->buf_sem);
+    if (src_data->dead || dst_data->dead)
+    {
+        ret = -ENODEV;
+        goto unlock;
+    }
+    if ((src_data->pdata.mode != PCD_MODE_ARRAY) || (dst_data->pdata.mode != PCD_MODE_ARRAY))
+    {
+        ret = -ESPIPE;
+        goto unlock;
+    }
+    /* like a write, nothing past the end of the destination. Short at the end of the source */
+    if (arg.dst_offset >= pcd_dev_size(dst_data))
+    {
+        ret = len ? -ENOMEM : 0;
+        goto unlock;
+    }
+    len = min_t(loff_t,len,pcd_dev_size(src_data) - min_t(loff_t,arg.src_offset,pcd_dev_size(src_data)));
+    len = min_t(loff_t,len,pcd_dev_size(dst_data) - arg.dst_offset);
+    if (!len)
+    {
+        ret = 0;
+        goto unlock;
+    }
+    if ((src_data == dst_data) && (arg.src_offset < arg.dst_offset + len) && (arg.dst_offset < arg.src_offset + len))
+    {
+        ret = -EINVAL; //overlapping copy within one device, same as copy_file_range()
+        goto unlock;
+    }
 
-    /* return number of bytes successfully written */
-    return count;
+    /* page granular when sharing: the locks cover the whole pages that change hands.
+    Only device pages are copied under them (bvec), nothing here can fault into a pcdev mapping */
+    ret = pcd_copy_lock(src_data,&src_range,round_down(arg.src_offset,PAGE_SIZE),round_up(arg.src_offset + len,PAGE_SIZE),
+                        dst_data,&dst_range,round_down(arg.dst_offset,PAGE_SIZE),round_up(arg.dst_offset + len,PAGE_SIZE));
+    if (ret)
+        goto unlock;
+    /* rechecked under the range locks, a shrink may have come in between */
+    len = min_t(loff_t,len,pcd_dev_size(src_data) - min_t(loff_t,arg.src_offset,pcd_dev_size(src_data)));
+    len = min_t(loff_t,len,pcd_dev_size(dst_data) - min_t(loff_t,arg.dst_offset,pcd_dev_size(dst_data)));
+    ret = len ? pcd_backing_clone(&dst_data->backing,arg.dst_offset,&src_data->backing,arg.src_offset,len,
+                                  arg.flags & PCD_COPY_SHARE) : 0;
+    if (dst_data->replicas && (ret > 0))
+        pcd_replicas_sync(dst_data,arg.dst_offset,arg.dst_offset + ret);
+    /* shared pages replaced dst's whole pages, like a punch their old mappings go */
+    if ((arg.flags & PCD_COPY_SHARE) && (ret > 0))
+        pcd_punch_unmap(dst_data,arg.dst_offset,arg.dst_offset + ret);
+    if (src_data != dst_data)
+        pcd_range_unlock(&src_data->wr_ranges,&src_range);
+    pcd_range_unlock(&dst_data->wr_ranges,&dst_range);
+unlock:
+    if (src_data != dst_data)
+        up_read(&src_data->buf_sem);
+    up_read(&dst_data->buf_sem);
+    if (ret >= 0)
+    {
+        pcd_stats_rw(src_data,false,ret,ret);
+        pcd_lat_record(src_data,PCD_LAT_READ,ret,t0);
+    }
+    trace_pcd_write(MINOR(dst_data->dev_num),arg.dst_offset,len,ret);
+    pcd_stats_rw(dst_data,true,len,ret);
+    pcd_lat_record(dst_data,PCD_LAT_WRITE,len,t0);
+put:
+    fput(src_file);
+    return ret;
+}
+
+/*
+ * One descriptor of a batch (or ring SQE), returns its result. Caller holds buf_sem shared, array mode.
+ * The buffer is user memory: writes fault it in before taking the range lock (pcd_array_write)
+ */
+ssize_t pcd_batch_one(struct file *filep, struct pcdev_private_data *pcdev_data, struct pcd_io_desc *desc, bool nowait)
+{
+    bool write = (desc->op == PCD_OP_WRITE);
+    struct iov_iter iter;
+    void __user *ubuf = u64_to_user_ptr(desc->buf);
+    ssize_t ret;
+    #if ( LINUX_VERSION_CODE < KERNEL_VERSION( 6, 0, 0 ) )
+    struct iovec iov;
+    #endif
+
+    if (((desc->op != PCD_OP_READ) && !write) || desc->reserved || (desc->offset > LLONG_MAX))
+        return -EINVAL;
+    if (!(filep->f_mode & (write ? FMODE_WRITE : FMODE_READ)))
+        return -EBADF;
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 0, 0 ) ) // Hack to support newer kernel versions (host linux is newer currently)
+    ret = import_ubuf(write ? WRITE : READ,ubuf,min_t(u64,desc->len,MAX_RW_COUNT),&iter);
+    #else
+    ret = import_single_range(write ? WRITE : READ,ubuf,min_t(u64,desc->len,MAX_RW_COUNT),&iov,&iter);
+    #endif
+    if (ret)
+        return ret;
+    if (write)
+        return pcd_array_write(pcdev_data,desc->offset,&iter,nowait);
+    return pcd_array_read(pcdev_data,desc->offset,&iter);
+}
+
+/*
+ * Many small scattered reads/writes in one kernel entry: buf_sem and the mode check once per batch,
+ * no lseek in between. Each descriptor is still accounted (stats, trace) as a read or write of its own.
+ * nowait: stops at the first descriptor that would wait (lock, source fault in, page allocation), the ones before it are done and
+ * counted (never run twice: a retry resubmits from the returned count). -EAGAIN when none ran.
+ * Returns how many descriptors ran, their results written back.
+ */
+static long pcd_batch_run(struct file *filep, struct pcdev_private_data *pcdev_data, u64 udescs, u32 nr, bool nowait)
+{
+    struct pcd_io_desc *descs;
+    u32 i;
+    long ret;
+
+    if (nr > PCD_BATCH_MAX)
+        return -EINVAL;
+    if (!nr)
+        return 0;
+    descs = vmemdup_user(u64_to_user_ptr(udescs),array_size(nr,sizeof(*descs)));
+    if (IS_ERR(descs))
+        return PTR_ERR(descs);
+
+    if (ret = pcd_buf_read_lock(pcdev_data,nowait))
+        goto free;
+    if (pcdev_data->pdata.mode != PCD_MODE_ARRAY)
+    {
+        up_read(&pcdev_data->buf_sem);
+        ret = -ESPIPE;
+        goto free;
+    }
+    for (i = 0; i < nr; i++)
+    {
+        if (fatal_signal_pending(current))
+            break;
+        descs[i].result = pcd_batch_one(filep,pcdev_data,&descs[i],nowait);
+        if (nowait && (descs[i].result == -EAGAIN))
+            break; //not run, nor are the ones after it
+        cond_resched();
+    }
+    up_read(&pcdev_data->buf_sem);
+
+    /* results of the descriptors that ran, the rest is left as it was */
+    ret = i ? i : (nowait ? -EAGAIN : -EINTR);
+    if (i && copy_to_user(u64_to_user_ptr(udescs),descs,array_size(i,sizeof(*descs))))
+        ret = -EFAULT;
+free:
+    kvfree(descs);
+    return ret;
+}
+
+static long pcd_batch(struct file *filep, struct pcdev_private_data *pcdev_data, void __user *argp)
+{
+    struct pcd_batch_arg arg;
+
+    if (copy_from_user(&arg,argp,sizeof(arg)))
+        return -EFAULT;
+    if (arg.flags)
+        return -EINVAL;
+    return pcd_batch_run(filep,pcdev_data,arg.descs,arg.nr,false);
+}
+
+/*
+ * fallocate() and copy_file_range() are refused by the VFS for character devices (-ENODEV/-EINVAL)
+ * before reaching the driver, so hole punching and device to device copies are ioctls (pcd_ioctl.h)
+ */
+long pcd_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+
+    if (pcd_dev_dead(pcdev_data))
+        return -ENODEV;
+    switch(cmd)
+    {
+        case PCD_IOC_PUNCH_HOLE:
+            return pcd_punch_hole(filep,pcdev_data,(void __user *)arg);
+        case PCD_IOC_COPY_RANGE:
+            return pcd_copy_range(filep,pcdev_data,(void __user *)arg);
+        case PCD_IOC_BATCH:
+            return pcd_batch(filep,pcdev_data,(void __user *)arg);
+        case PCD_IOC_RING_SETUP:
+            return pcd_ring_setup(filep,pcdev_data,(void __user *)arg);
+        default:
+            return -ENOTTY;
+    }
+}
+
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 1, 0 ) ) // Hack to support newer kernel versions (host linux is newer currently)
+/*
+ * io_uring passthrough: the same batch as PCD_IOC_BATCH plus resize and a stats snapshot, so one ring can
+ * drive many devices without a blocking syscall. Commands finish before returning, the result is posted
+ * inline. On the non blocking first issue, anything that would sleep for a lock returns -EAGAIN instead,
+ * io_uring then issues the command again from one of its workers where it may block.
+ */
+int pcd_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+    struct file *filep = ioucmd->file;
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+    bool nowait = issue_flags & IO_URING_F_NONBLOCK;
+    #if ( LINUX_VERSION_CODE >= KERNEL_VERSION( 6, 6, 0 ) )
+    const void *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+    #else
+    const void *cmd = ioucmd->cmd;
+    #endif
+    const struct pcd_batch_arg *batch = cmd;
+    const struct pcd_resize_arg *resize = cmd;
+    const struct pcd_stats_arg *stats = cmd;
+    struct pcd_stats_snap snap;
+    int ret;
+
+    if (ioucmd->flags & IORING_URING_CMD_FIXED)
+        return -EOPNOTSUPP; //no registered buffers, descriptors carry plain user pointers
+    if (pcd_dev_dead(pcdev_data))
+        return -ENODEV;
+
+    switch(ioucmd->cmd_op)
+    {
+        case PCD_URING_CMD_BATCH:
+            if (READ_ONCE(batch->flags))
+                return -EINVAL;
+            return pcd_batch_run(filep,pcdev_data,READ_ONCE(batch->descs),READ_ONCE(batch->nr),nowait);
+        case PCD_URING_CMD_RESIZE:
+            /* same rights as the max_size attribute (root), on a writable fd */
+            if (!(filep->f_mode & FMODE_WRITE))
+                return -EBADF;
+            if (!capable(CAP_SYS_ADMIN))
+                return -EPERM;
+            if (nowait)
+                return -EAGAIN; //waits for writers past the new end on a shrink
+            return pcd_dev_resize(pcdev_data,READ_ONCE(resize->size));
+        case PCD_URING_CMD_STATS:
+            if (ret = pcd_stats_snapshot(pcdev_data,&snap,nowait))
+                return ret;
+            if (copy_to_user(u64_to_user_ptr(READ_ONCE(stats->buf)),&snap,sizeof(snap)))
+                return -EFAULT;
+            return PCD_DRV_SUCCESS;
+        default:
+            return -ENOTTY;
+    }
+}
+#endif
+
+__poll_t pcd_poll(struct file *filep, poll_table *wait)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)(filep->private_data);
+
+    if (pcd_dev_dead(pcdev_data))
+        return EPOLLERR | EPOLLHUP; //removed, nothing will ever come
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_FIFO)
+        return pcd_fifo_poll(filep,wait);
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_MSG)
+        return pcd_msg_poll(filep,wait);
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_LOG)
+        return pcd_log_poll(filep,wait);
+    /* array mode never blocks, same as a regular file */
+    return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
 }
 
 int check_permission(int dev_perm, int access_mode)
@@ -121,8 +960,8 @@ int check_permission(int dev_perm, int access_mode)
     /*Ensure Write only access*/
     if ((DEV_DRV_PERM_WRONLY==dev_perm)&&(!(access_mode&FMODE_READ) && (access_mode&FMODE_WRITE)))
         return PCD_DRV_SUCCESS;
-    pr_info("FAILED. DEBUG msg: access_mode: 0x%x, fmode_values: FMODE_READ: 0x%x and FMODE_WRITE: 0x%x\n",access_mode,FMODE_READ,FMODE_WRITE);
-    pr_info("FAILED. DEBUG msg: local dev perm: 0x%x\n",dev_perm);
+    pr_debug("FAILED. DEBUG msg: access_mode: 0x%x, fmode_values: FMODE_READ: 0x%x and FMODE_WRITE: 0x%x\n",access_mode,FMODE_READ,FMODE_WRITE);
+    pr_debug("FAILED. DEBUG msg: local dev perm: 0x%x\n",dev_perm);
     return -EPERM;
 }
 
@@ -130,26 +969,55 @@ int pcd_open(struct inode *inode, struct file *filep)
 {
     int ret=0;
     struct pcdev_private_data *pcdev_data;
+    u64 t0 = local_clock();
     /* find out on which device file open was attempted by userspace */
     int minor_n=MINOR(inode->i_rdev);
-    pr_info("minor access: %d\n",minor_n);
 
-    /* Get device private data struct */
-    pcdev_data = container_of(inode->i_cdev,struct pcdev_private_data,cdev);
+    /* Get device private data struct. One cdev serves all minors, look the device up.
+    Ref taken under the xarray lock: remove erases the minor before dropping probe's ref */
+    xa_lock(&pcdrv_data.devices);
+    pcdev_data = xa_load(&pcdrv_data.devices,minor_n);
+    if (pcdev_data)
+        pcd_dev_get(pcdev_data);
+    xa_unlock(&pcdrv_data.devices);
+    if (!pcdev_data)
+    {
+        trace_pcd_open(minor_n,filep->f_mode,-ENXIO);
+        return -ENXIO; //minor not (or no longer) bound to a device
+    }
 
     /* Supply device private data to other methods (seek,read,write). 
     Other methods will not have access to inode. 
     That's why you can store in filep and reuse. */
     filep->private_data = (void*)pcdev_data;
+    /* mappings go on the device's own inode, whatever node this was opened by: one zap reaches them all */
+    filep->f_mapping = pcdev_data->inode->i_mapping;
+
+    /* IOCB_NOWAIT: locks are only trylocked, array writes don't fault in the source or allocate pages (-EAGAIN instead).
+    So RWF_NOWAIT can be honoured */
+    filep->f_mode |= FMODE_NOWAIT;
+
+    /* a fifo or a queue is a stream: no position, no pread/pwrite.
+    In a log the position is this file's read cursor, a record number: starts at the oldest record there is */
+    if (READ_ONCE(pcdev_data->pdata.mode) == PCD_MODE_LOG)
+        filep->f_pos = pcd_log_open_pos(pcdev_data);
+    else if (READ_ONCE(pcdev_data->pdata.mode) != PCD_MODE_ARRAY)
+        stream_open(inode,filep);
 
     /* check permission */
     ret = check_permission(pcdev_data->pdata.perm,filep->f_mode);
-    (!ret)?pr_info("open is successful\n"):pr_info("open is unsuccessful\n");
+    trace_pcd_open(minor_n,filep->f_mode,ret);
+    if (!ret)
+        pcd_stats_inc(pcdev_data,PCD_STAT_OPENS);
+    pcd_lat_record(pcdev_data,PCD_LAT_OPEN,0,t0);
+    if (ret)
+        pcd_dev_put(pcdev_data); //no release for a failed open
     return ret;
 }
 
 int pcd_release(struct inode *inode, struct file *filep)
 {
-    pr_info("release is successful\n");
+    trace_pcd_release(MINOR(inode->i_rdev));
+    pcd_dev_put((struct pcdev_private_data*)(filep->private_data));
     return 0;
 }
\ No newline at end of file